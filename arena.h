@@ -0,0 +1,92 @@
+// MIT License
+//
+// Copyright(c) 2023 Matthieu Bucchianeri
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this softwareand associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+// A bump allocator for the edited copies of the application's structures that we pass down to the runtime. Nothing
+// is freed individually: reset() makes all the memory available again, and keeps the blocks for reuse.
+class Arena {
+  public:
+    explicit Arena(size_t blockSize = 4096) : m_blockSize(blockSize) {
+    }
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t size, size_t alignment = alignof(std::max_align_t)) {
+        while (m_current < m_blocks.size()) {
+            Block& block = m_blocks[m_current];
+            const size_t offset = (m_offset + alignment - 1) & ~(alignment - 1);
+            if (offset + size <= block.size) {
+                m_offset = offset + size;
+                return block.data.get() + offset;
+            }
+            m_current++;
+            m_offset = 0;
+        }
+
+        // Blocks are aligned like operator new, so a fresh block satisfies any fundamental alignment.
+        const size_t blockSize = std::max(m_blockSize, size);
+        m_blocks.push_back({std::make_unique<uint8_t[]>(blockSize), blockSize});
+        m_current = m_blocks.size() - 1;
+        m_offset = size;
+        return m_blocks.back().data.get();
+    }
+
+    template <typename T>
+    T* copy(const T& value) {
+        return new (allocate(sizeof(T), alignof(T))) T(value);
+    }
+
+    template <typename T>
+    T* copyArray(const T* values, size_t count) {
+        if (!count) {
+            return nullptr;
+        }
+        T* const array = static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+        std::uninitialized_copy_n(values, count, array);
+        return array;
+    }
+
+    const char* copyString(const char* string) {
+        const size_t size = strlen(string) + 1;
+        char* const copy = static_cast<char*>(allocate(size, 1));
+        memcpy(copy, string, size);
+        return copy;
+    }
+
+    void reset() {
+        m_current = 0;
+        m_offset = 0;
+    }
+
+  private:
+    struct Block {
+        std::unique_ptr<uint8_t[]> data;
+        size_t size;
+    };
+
+    const size_t m_blockSize;
+    std::vector<Block> m_blocks;
+    size_t m_current = 0;
+    size_t m_offset = 0;
+};
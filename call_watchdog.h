@@ -0,0 +1,200 @@
+// MIT License
+//
+// Copyright(c) 2023 Matthieu Bucchianeri
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this softwareand associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#pragma once
+
+// A watchdog for the calls that we make to the runtime. Each thread publishes the call that it is in (name and entry
+// time) with relaxed atomics, which costs a performance counter read per call, and a background thread periodically
+// looks for calls that have been running for longer than the threshold. The watchdog may see the name of one call
+// with the entry time of the next one, which is harmless for a diagnostic.
+class CallWatchdog {
+    // The call that a thread is in, or a null entry time.
+    struct Call {
+        std::atomic<const char*> name{nullptr};
+        std::atomic<int64_t> enteredAt{0};
+        std::atomic<uint32_t> threadId{0};
+    };
+
+  public:
+    // Called from the watchdog thread when a call exceeds the threshold, and when that call eventually returns.
+    using ReportFunction = void (*)(const char* name, uint32_t threadId, double milliseconds, bool hasReturned);
+    using InitializeFunction = void (*)();
+
+    // Marks the current thread as being in a call for its lifetime.
+    class Scope {
+      public:
+        Scope(CallWatchdog& watchdog, const char* name) {
+            if (!watchdog.m_isEnabled.load(std::memory_order_relaxed)) {
+                return;
+            }
+            m_call = watchdog.getThreadCall();
+            if (!m_call) {
+                return;
+            }
+
+            // Our hooks might be nested, in which case the outer call is still in flight when we return.
+            m_previousName = m_call->name.load(std::memory_order_relaxed);
+            m_previousEnteredAt = m_call->enteredAt.load(std::memory_order_relaxed);
+            LARGE_INTEGER now;
+            QueryPerformanceCounter(&now);
+            m_call->name.store(name, std::memory_order_relaxed);
+            m_call->enteredAt.store(now.QuadPart, std::memory_order_relaxed);
+        }
+
+        ~Scope() {
+            if (m_call) {
+                m_call->name.store(m_previousName, std::memory_order_relaxed);
+                m_call->enteredAt.store(m_previousEnteredAt, std::memory_order_relaxed);
+            }
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+      private:
+        Call* m_call{nullptr};
+        const char* m_previousName{nullptr};
+        int64_t m_previousEnteredAt{0};
+    };
+
+    ~CallWatchdog() {
+        // At process exit, the thread was already terminated.
+        if (m_thread.joinable()) {
+            m_thread.detach();
+        }
+    }
+
+    // The threshold is in performance counter ticks. The initialize() callback runs first on the new thread.
+    void start(int64_t threshold,
+               int64_t performanceCounterFrequency,
+               ReportFunction report,
+               InitializeFunction initialize = nullptr) {
+        if (m_thread.joinable() || threshold <= 0) {
+            return;
+        }
+        m_threshold = threshold;
+        m_frequency = performanceCounterFrequency;
+        m_report = report;
+        m_initialize = initialize;
+        m_isEnabled = true;
+        m_thread = std::thread([this] { run(); });
+    }
+
+    void stop() {
+        if (!m_thread.joinable()) {
+            return;
+        }
+        m_isEnabled = false;
+        m_stop.SetEvent();
+        m_thread.join();
+    }
+
+    // Give the slot of the calling thread back, when the thread exits.
+    void releaseThreadCall() {
+        Call*& call = getThreadCallSlot();
+        if (call) {
+            call->name.store(nullptr, std::memory_order_relaxed);
+            call->enteredAt.store(0, std::memory_order_relaxed);
+            call->threadId.store(0, std::memory_order_release);
+            call = nullptr;
+        }
+    }
+
+  private:
+    // Threads are given a free slot on their first call, and keep it until they exit. Calls from a thread that finds no
+    // free slot are not watched.
+    static constexpr uint32_t MaxThreads = 64;
+
+    static Call*& getThreadCallSlot() {
+        thread_local Call* call = nullptr;
+        return call;
+    }
+
+    Call* getThreadCall() {
+        Call*& call = getThreadCallSlot();
+        thread_local bool hasLookedForCall = false;
+        if (!call && !hasLookedForCall) {
+            hasLookedForCall = true;
+            const uint32_t threadId = GetCurrentThreadId();
+            for (Call& candidate : m_calls) {
+                uint32_t freeThreadId = 0;
+                if (!candidate.threadId.load(std::memory_order_relaxed) &&
+                    candidate.threadId.compare_exchange_strong(freeThreadId, threadId)) {
+                    call = &candidate;
+                    break;
+                }
+            }
+        }
+        return call;
+    }
+
+    void run() {
+        if (m_initialize) {
+            m_initialize();
+        }
+
+        // The entry time of the call that we reported for each slot, to report it only once.
+        std::array<int64_t, MaxThreads> reportedEnteredAt{};
+        std::array<const char*, MaxThreads> reportedName{};
+        std::array<uint32_t, MaxThreads> reportedThreadId{};
+
+        const DWORD period = (DWORD)std::max<int64_t>(10, m_threshold * 1000 / m_frequency / 4);
+        while (!m_stop.wait(period)) {
+            LARGE_INTEGER now;
+            QueryPerformanceCounter(&now);
+            const auto toMilliseconds = [this](int64_t ticks) { return ticks * 1000.0 / m_frequency; };
+
+            for (uint32_t i = 0; i < MaxThreads; i++) {
+                const Call& call = m_calls[i];
+                const uint32_t threadId = call.threadId.load(std::memory_order_acquire);
+                const int64_t enteredAt = call.enteredAt.load(std::memory_order_relaxed);
+                // The slot might have been given to another thread since the last scan.
+                if (reportedEnteredAt[i] && (enteredAt != reportedEnteredAt[i] || threadId != reportedThreadId[i])) {
+                    // We only know that it returned since the last scan.
+                    m_report(reportedName[i],
+                             reportedThreadId[i],
+                             toMilliseconds(now.QuadPart - reportedEnteredAt[i]),
+                             true);
+                    reportedEnteredAt[i] = 0;
+                }
+                if (threadId && enteredAt && !reportedEnteredAt[i] && now.QuadPart - enteredAt > m_threshold) {
+                    reportedEnteredAt[i] = enteredAt;
+                    reportedName[i] = call.name.load(std::memory_order_relaxed);
+                    reportedThreadId[i] = threadId;
+                    m_report(reportedName[i], threadId, toMilliseconds(now.QuadPart - enteredAt), false);
+                }
+            }
+        }
+    }
+
+    int64_t m_threshold{0};
+    int64_t m_frequency{1};
+    ReportFunction m_report{nullptr};
+    InitializeFunction m_initialize{nullptr};
+    std::atomic<bool> m_isEnabled{false};
+
+    std::array<Call, MaxThreads> m_calls;
+
+    wil::unique_event m_stop{wil::EventOptions::None};
+    std::thread m_thread;
+};
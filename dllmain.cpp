@@ -22,106 +22,2975 @@
 
 #include "pch.h"
 
+#include "arena.h"
+#include "call_watchdog.h"
+#include "dynamic_resolution.h"
+#include "extension_name.h"
+#include "flight_recorder.h"
+#include "frame_submission.h"
+#include "hand_joints.h"
+#include "perfect_hash.h"
+#include "performance_profile.h"
+#include "pretty_printer.h"
+#include "slow_call_logger.h"
+#include "structure_chain.h"
+#include "time_conversion.h"
+#include "visibility_mask.h"
+
+#include "include/XR_MBUCCHIA_dynamic_resolution.h"
+
+#ifdef WRAPPER_BAKED_CONFIG
+#include "baked_config.h"
+#endif
+
+#ifdef WRAPPER_API_LAYER
+// The name of the layer, as it appears in our API layer manifest.
+#define LAYER_NAME "XR_APILAYER_MBUCCHIA_instance_extensions_wrapper"
+#endif
+
 namespace {
 
-    // Handle and function pointers to the chained runtime library.
-    wil::unique_hmodule chainedRuntimeModule;
-    PFN_xrNegotiateLoaderRuntimeInterface next_xrNegotiateLoaderRuntimeInterface = nullptr;
-    PFN_xrGetInstanceProcAddr next_xrGetInstanceProcAddr = nullptr;
-    PFN_xrEnumerateInstanceExtensionProperties next_xrEnumerateInstanceExtensionProperties = nullptr;
+    // Handle and function pointers to the chained runtime library.
+    wil::unique_hmodule chainedRuntimeModule;
+    PFN_xrNegotiateLoaderRuntimeInterface next_xrNegotiateLoaderRuntimeInterface = nullptr;
+    PFN_xrGetInstanceProcAddr next_xrGetInstanceProcAddr = nullptr;
+    PFN_xrEnumerateInstanceExtensionProperties next_xrEnumerateInstanceExtensionProperties = nullptr;
+    PFN_xrCreateInstance next_xrCreateInstance = nullptr;
+
+#ifdef WRAPPER_BAKED_CONFIG
+    // The rules are baked into the binary at build time.
+    using ExtensionRules = baked::ExtensionRules;
+    const ExtensionRules& runtimeRules = baked::RuntimeRules;
+    using FunctionOverride = baked::FunctionOverride;
+    const auto& functionOverrides = baked::FunctionOverrides;
+#else
+    // The rules applied to the list of instance extensions, loaded from our configuration file.
+    struct ExtensionRules {
+        std::vector<ExtensionName> extensionsToMask;
+        std::vector<ExtensionVersionRule> extensionVersions;
+
+        bool isMasked(const char* extensionName) const {
+            for (const ExtensionName& extensionToMask : extensionsToMask) {
+                if (isSameExtensionName(extensionName, extensionToMask)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        const ExtensionVersionRule* findVersionRule(const char* extensionName) const {
+            return findExtensionVersionRule(extensionVersions, extensionName);
+        }
+    };
+
+    // The rules for the runtime's own extensions, and for the extensions of each API layer (from the [layer:<name>]
+    // sections).
+    ExtensionRules runtimeRules;
+    std::map<std::string, ExtensionRules, std::less<>> layerRules;
+
+    // The functions to hide from the application (or to replace with a stub), indexed by the hash of their name.
+    struct FunctionOverride {
+        uint64_t nameHash;
+        bool isStub;
+    };
+    std::vector<FunctionOverride> functionOverrides;
+#endif
+
+    // The names of the core functions, and of the functions of each extension, with their precomputed hash.
+    struct FunctionName {
+        uint64_t hash;
+        const char* name;
+    };
+#define FUNCTION_NAME(name, feature) FunctionName{hashName("xr" #name), "xr" #name},
+#define EXTENSION_FUNCTION_NAMES(extension, number)                                                                   \
+    constexpr FunctionName extension##_Functions[] = {XR_LIST_FUNCTIONS_##extension(FUNCTION_NAME) FunctionName{}};
+#define EXTENSION_ENTRY(extension, number) {#extension, extension##_Functions},
+    constexpr FunctionName coreFunctions[] = {XR_LIST_FUNCTIONS_XR_VERSION_1_0(FUNCTION_NAME) FunctionName{}};
+    XR_LIST_EXTENSIONS(EXTENSION_FUNCTION_NAMES)
+    constexpr std::pair<std::string_view, const FunctionName*> extensionFunctions[] = {
+        XR_LIST_EXTENSIONS(EXTENSION_ENTRY)};
+#undef EXTENSION_ENTRY
+#undef EXTENSION_FUNCTION_NAMES
+#undef FUNCTION_NAME
+
+    const char* findFunctionName(uint64_t nameHash) {
+        for (const FunctionName* functionName = coreFunctions; functionName->name; functionName++) {
+            if (functionName->hash == nameHash) {
+                return functionName->name;
+            }
+        }
+        for (const auto& [extensionName, functionNames] : extensionFunctions) {
+            for (const FunctionName* functionName = functionNames; functionName->name; functionName++) {
+                if (functionName->hash == nameHash) {
+                    return functionName->name;
+                }
+            }
+        }
+        return "<unknown function>";
+    }
+
+    // The runtime's function pointers for each instance, indexed by the hash of their name. In eager mode, they are all
+    // resolved at instance creation. In lazy mode, the table starts with null pointers for all the functions that are
+    // available (core and enabled extensions), and each one is resolved on first use.
+    std::shared_mutex instancesMutex;
+    std::unordered_map<XrInstance, std::unordered_map<uint64_t, PFN_xrVoidFunction>> instanceFunctions;
+
+    // The instance that our hooks resolve their next function against.
+    std::atomic<XrInstance> currentInstance{XR_NULL_HANDLE};
+
+    // Whether to resolve the runtime's functions on first use rather than at instance creation.
+    bool lazyResolution = false;
+
+    // Whether to time both resolution strategies at instance creation.
+    bool benchmarkResolution = false;
+    std::atomic<uint32_t> lazyResolutionCount{0};
+    std::atomic<int64_t> lazyResolutionTime{0};
+
+    // Whether to convert between the performance counter and XrTime ourselves, with a mapping calibrated against the
+    // runtime. The mapping is re-validated against the runtime when a conversion lands further than one second (of
+    // performance counter ticks) from the last validation.
+    bool localTimeConversion = true;
+    int64_t performanceCounterFrequency = 0;
+    ClockMapping performanceCounterMapping;
+    std::mutex timeCalibrationMutex;
+    std::atomic<bool> timeCalibrationFailed{false};
+    std::atomic<uint32_t> localTimeConversionCount{0};
+    std::atomic<uint32_t> runtimeTimeConversionCount{0};
+    std::atomic<uint32_t> timeCalibrationCount{0};
+
+    // The drift (in nanoseconds) beyond which the mapping is recalibrated.
+    constexpr int64_t TimeConversionTolerance = 1000;
+
+    // Whether to serve the constant properties of each instance (and its systems) from a copy of the runtime's answer.
+    // xrGetSystem() is not cached: the runtime reports XR_ERROR_FORM_FACTOR_UNAVAILABLE when the headset goes away.
+    bool cacheProperties = true;
+
+#ifdef XR_USE_GRAPHICS_API_VULKAN
+    // The Vulkan extensions to remove from the lists that the runtime requires, and from the Vulkan instances and
+    // devices that the runtime creates for the application. Same for the layers.
+#ifdef WRAPPER_BAKED_CONFIG
+    const auto& vulkanExtensionsToMask = baked::VulkanExtensionsToMask;
+    const auto& vulkanLayersToMask = baked::VulkanLayersToMask;
+#else
+    std::vector<std::string> vulkanExtensionsToMask;
+    std::vector<std::string> vulkanLayersToMask;
+#endif
+#endif
+
+    // The answers that we cached for each instance.
+    struct InstanceCache {
+        StructureChainCache instanceProperties;
+        std::map<XrSystemId, StructureChainCache> systemProperties;
+#ifdef XR_USE_GRAPHICS_API_VULKAN
+        std::map<XrSystemId, std::string> vulkanInstanceExtensions;
+        std::map<XrSystemId, std::string> vulkanDeviceExtensions;
+#endif
+    };
+    std::shared_mutex instanceCachesMutex;
+    std::unordered_map<XrInstance, InstanceCache> instanceCaches;
+
+    // Whether to serve the visibility masks from a copy of the runtime's answer, until the runtime signals a change.
+    bool cacheVisibilityMasks = true;
+
+    // The visibility masks that we cached, per session, view configuration, view and mask type.
+    struct VisibilityMask {
+        std::vector<XrVector2f> vertices;
+        std::vector<uint32_t> indices;
+    };
+    using VisibilityMaskKey = std::tuple<XrSession, XrViewConfigurationType, uint32_t, XrVisibilityMaskTypeKHR>;
+    std::shared_mutex visibilityMasksMutex;
+    std::map<VisibilityMaskKey, VisibilityMask> visibilityMasks;
+
+    // Whether to advertise XR_KHR_visibility_mask when the runtime does not implement it, and generate the masks from
+    // the field of view of each view. The extension is only added to the runtime's list of extensions.
+    bool synthesizeVisibilityMask = false;
+    const ExtensionName visibilityMaskExtensionName = makeExtensionName(XR_KHR_VISIBILITY_MASK_EXTENSION_NAME);
+    std::atomic<bool> isVisibilityMaskSynthesized{false};
+
+    // The synthesized visibility masks, per session, view configuration and view, for the last field of view that the
+    // runtime reported for that view. The field of view is not known yet when the application asked for a mask
+    // before locating the views, in which case it was given an empty mask. Protected by visibilityMasksMutex.
+    struct SynthesizedVisibilityMask {
+        XrFovf fov;
+        bool isFovKnown;
+        std::map<XrVisibilityMaskTypeKHR, VisibilityMask> masks;
+    };
+    using SynthesizedVisibilityMaskKey = std::tuple<XrSession, XrViewConfigurationType, uint32_t>;
+    std::map<SynthesizedVisibilityMaskKey, SynthesizedVisibilityMask> synthesizedVisibilityMasks;
+
+    // How much (in radians) a field of view must change for its mask to be regenerated. Some runtimes move the field
+    // of view slightly every frame (for example with eye tracking), and the mask does not need to follow that closely.
+    constexpr float VisibilityMaskFovTolerance = 0.01f;
+
+    // Whether to advertise our XR_MBUCCHIA_dynamic_resolution extension, and the lowest resolution scale that we may
+    // ask the application to render at.
+    bool dynamicResolution = false;
+    float dynamicResolutionMinScale = 0.5f;
+    const ExtensionName dynamicResolutionExtensionName =
+        makeExtensionName(XR_MBUCCHIA_DYNAMIC_RESOLUTION_EXTENSION_NAME);
+
+    // The extensions that we implement ourselves, and that the application enabled on the current instance.
+    struct ImplementedExtensions {
+        bool visibilityMask = false;
+        bool dynamicResolution = false;
+    };
+    ImplementedExtensions implementedExtensions;
+
+    // Whether to return the same space to the application when it creates identical spaces, so that the runtime only
+    // tracks and locates each unique space once. Each shared space is destroyed when its last reference is.
+    // The application sees equal handles for identical spaces, which the specification does not forbid but which an
+    // application might not expect (for example when it uses the handles as keys in a map, or checks that a new space
+    // differs from the old one). Only enable this option for applications known to cope with it.
+    bool shareSpaces = false;
+
+    // The shared spaces, indexed by what they were created from (reference space type or action, pose), and the
+    // number of references to each one.
+    using SpaceKey = std::tuple<XrSession, bool, uint64_t, XrPath, std::array<float, 7>>;
+    struct SharedSpace {
+        SpaceKey key;
+        uint32_t references;
+    };
+    std::mutex sharedSpacesMutex;
+    std::map<SpaceKey, XrSpace> spacesByKey;
+    std::unordered_map<XrSpace, SharedSpace> sharedSpaces;
+    std::atomic<uint32_t> sharedSpaceCount{0};
+
+    // The shared spaces whose last reference was destroyed, with their session, to catch the application destroying
+    // them once more. A handle leaves this list when the runtime returns it again for a new space.
+    std::unordered_map<XrSpace, XrSession> destroyedSharedSpaces;
+
+    // The rate (in Hz) at which to query the hand joints from the runtime, for each hand tracker. The queries in
+    // between are extrapolated from the last two samples. 0 to always query the runtime.
+    double handTrackingRate = 0;
+
+    // How far from the latest sample we extrapolate the hand joints.
+    constexpr XrDuration MaxHandJointsExtrapolation = 50'000'000;
+
+    // The last two samples of each hand tracker.
+    struct HandTrackerState {
+        XrSpace baseSpace;
+        HandJointsSample samples[2];
+        uint32_t sampleCount;
+        int64_t lastQueryCounter;
+    };
+    std::mutex handTrackersMutex;
+    std::unordered_map<XrHandTrackerEXT, HandTrackerState> handTrackers;
+    std::atomic<uint32_t> extrapolatedHandJointsCount{0};
+    std::atomic<uint32_t> handJointsQueryCount{0};
+    std::atomic<int64_t> handJointsQueryTime{0};
+
+    // The timing of the frames, from our frame hooks, and the resolution scale that we gave the application for each of
+    // the last few frames (by predicted display time).
+    std::mutex framesMutex;
+    int64_t frameWaitCounter = 0;
+    XrDuration lastFrameTime = 0;
+    DynamicResolutionController dynamicResolutionController;
+    std::array<std::pair<XrTime, float>, 4> frameScales{};
+    uint32_t nextFrameScale = 0;
+
+    // Whether to return from xrEndFrame() immediately, and submit a copy of the frame to the runtime from our own
+    // thread. Only D3D12 sessions qualify by default: the runtime must not use the application's device context from
+    // another thread. An error from the runtime is returned one frame late, by the next xrEndFrame(). The submission
+    // is only waited for in xrWaitFrame() and xrBeginFrame(), so an application that acquires or waits for swapchain
+    // images before xrWaitFrame() does so while the previous frame is still being submitted.
+    bool asyncEndFrame = false;
+
+    // Whether Vulkan sessions also qualify. XR_KHR_vulkan_enable(2) requires the application to not use the VkQueue
+    // that it gave the runtime during xrEndFrame(), which no longer holds: the application can submit to that queue
+    // while our thread is in xrEndFrame(). Only for applications that are known to not do so.
+    bool asyncEndFrameVulkan = false;
+    std::set<XrSession> asyncEndFrameSessions;
+    FrameSubmissionThread frameSubmissionThread;
+    std::atomic<uint32_t> asyncEndFrameCount{0};
+    std::atomic<uint32_t> syncEndFrameCount{0};
+
+    // The scheduling of the threads that run the frame loop: the ones that call xrWaitFrame(), xrBeginFrame() and
+    // xrEndFrame(), and our frame submission thread. It is applied the first time that we see each thread.
+    std::optional<int> frameThreadPriority;
+    DWORD_PTR frameThreadAffinity = 0;
+    // The MMCSS task is a view of a null-terminated string.
+    std::wstring_view frameThreadTask;
+#ifndef WRAPPER_BAKED_CONFIG
+    std::wstring frameThreadTaskStorage;
+#endif
+
+    // Whether to run our background threads in the efficiency mode of Windows, which prefers the efficiency cores.
+    bool efficientBackgroundThreads = false;
+
+    // The sessions for which we pick the refresh rate from the frame time, once the application has warmed up.
+    struct RefreshRateSelection {
+        std::vector<float> refreshRates;
+        XrDuration frameTimeSum = 0;
+        uint32_t frameCount = 0;
+    };
+    std::map<XrSession, RefreshRateSelection> refreshRateSelections;
+    constexpr uint32_t RefreshRateWarmupFrames = 90;
+    constexpr uint32_t RefreshRateSelectionFrames = 300;
+
+    // The performance profile for all applications, and the ones for specific applications.
+    PerformanceProfile defaultPerformanceProfile;
+#ifdef WRAPPER_BAKED_CONFIG
+    const auto& appPerformanceProfiles = baked::AppPerformanceProfiles;
+#else
+    std::map<std::string, PerformanceProfile, std::less<>> appPerformanceProfiles;
+#endif
+
+    // Whether to lower the level of a domain by one step when the runtime reports that it left its nominal range.
+    bool stepDownPerformanceLevel = false;
+
+    const ExtensionName performanceSettingsExtensionName =
+        makeExtensionName(XR_EXT_PERFORMANCE_SETTINGS_EXTENSION_NAME);
+
+    // The profile of the current instance, whether XR_EXT_performance_settings is enabled on the runtime, and whether
+    // we enabled it without the application knowing. The levels that we requested are kept per session.
+    PerformanceProfile performanceProfile;
+    bool isPerformanceSettingsEnabled = false;
+    bool isPerformanceSettingsHidden = false;
+    std::mutex performanceLevelsMutex;
+    std::map<XrSession, PerformanceProfile> performanceLevels;
+
+    // Same as above for XR_FB_display_refresh_rate, which we enable even when it is masked from the application (so
+    // that the application does not fight our choice of refresh rate).
+    const ExtensionName displayRefreshRateExtensionName = makeExtensionName(XR_FB_DISPLAY_REFRESH_RATE_EXTENSION_NAME);
+    bool isDisplayRefreshRateEnabled = false;
+    bool isDisplayRefreshRateHidden = false;
+
+    // The events that we queue for the application, delivered before the runtime's events.
+    std::mutex pendingEventsMutex;
+    std::deque<XrEventDataBuffer> pendingEvents;
+
+    // The masked lists of extensions, indexed by layer name (empty for the runtime). The runtime's list does not change
+    // during the lifetime of the process, so we only query it once.
+    std::mutex extensionSnapshotsMutex;
+    std::map<std::string, std::vector<XrExtensionProperties>, std::less<>> extensionSnapshots;
+
+    // Whether to time the extension name matching at startup. The benchmark is only compiled in Debug builds.
+    bool benchmarkMasking = false;
+
+    std::ofstream logStream;
+    std::mutex logMutex;
+
+    // Basic logging function.
+    void Log(const char* fmt, ...) {
+        const std::time_t now = std::time(nullptr);
+        char buf[1024];
+        size_t offset = std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S %z: ", std::localtime(&now));
+        va_list va;
+        va_start(va, fmt);
+        vsnprintf_s(buf + offset, sizeof(buf) - offset, _TRUNCATE, fmt, va);
+        va_end(va);
+
+        OutputDebugStringA(buf);
+        std::unique_lock lock(logMutex);
+        if (logStream.is_open()) {
+            logStream << buf;
+            logStream.flush();
+        }
+    }
+
+    const ExtensionRules& getExtensionRules(const char* layerName) {
+        if (!layerName) {
+            return runtimeRules;
+        }
+#ifdef WRAPPER_BAKED_CONFIG
+        for (const auto& [name, rules] : baked::LayerRules) {
+            if (name == layerName) {
+                return rules;
+            }
+        }
+        return baked::NoRules;
+#else
+        static const ExtensionRules noRules;
+        const auto it = layerRules.find(std::string_view(layerName));
+        return it != layerRules.cend() ? it->second : noRules;
+#endif
+    }
+
+#ifdef _DEBUG
+    // Time the vectorized extension name matching against the scalar implementation on a long synthetic list.
+    void runMaskingBenchmark() {
+        constexpr size_t ExtensionCount = 512;
+        constexpr size_t RuleCount = 16;
+        constexpr int Iterations = 200;
+
+        // Use long, shared prefixes like real extension names, so that the comparisons cannot exit early.
+        std::vector<XrExtensionProperties> propertiesArray(ExtensionCount, {XR_TYPE_EXTENSION_PROPERTIES});
+        for (size_t i = 0; i < propertiesArray.size(); i++) {
+            sprintf_s(propertiesArray[i].extensionName,
+                      sizeof(propertiesArray[i].extensionName),
+                      "XR_VENDOR_some_rather_long_extension_name_%03zu",
+                      i);
+        }
+        std::vector<ExtensionName> rules;
+        for (size_t i = 0; i < RuleCount; i++) {
+            rules.push_back(makeExtensionName(propertiesArray[(i * 37) % ExtensionCount].extensionName));
+        }
+
+        const auto measure = [&](auto&& compare) {
+            volatile size_t matches = 0;
+            const auto start = std::chrono::high_resolution_clock::now();
+            for (int iteration = 0; iteration < Iterations; iteration++) {
+                for (const XrExtensionProperties& properties : propertiesArray) {
+                    for (const ExtensionName& rule : rules) {
+                        if (compare(properties.extensionName, rule)) {
+                            matches = matches + 1;
+                            break;
+                        }
+                    }
+                }
+            }
+            const auto duration = std::chrono::high_resolution_clock::now() - start;
+            return std::chrono::duration<double, std::nano>(duration).count() / (Iterations * ExtensionCount);
+        };
+
+        const double scalarTime = measure(isSameExtensionNameScalar);
+        const double vectorTime = measure(isSameExtensionName);
+        Log("Masking benchmark (%zu extensions, %zu rules): scalar %.1f ns/extension, vector %.1f ns/extension\n",
+            ExtensionCount,
+            RuleCount,
+            scalarTime,
+            vectorTime);
+    }
+#endif
+
+    // Query the real list of extensions, with the two-call idiom.
+    XrResult enumerateExtensions(PFN_xrEnumerateInstanceExtensionProperties enumerate,
+                                 const char* layerName,
+                                 std::vector<XrExtensionProperties>& propertiesArray) {
+        uint32_t count = 0;
+        XrResult result = enumerate(layerName, 0, &count, nullptr);
+        if (XR_SUCCEEDED(result)) {
+            propertiesArray.assign(count, {XR_TYPE_EXTENSION_PROPERTIES});
+            result = enumerate(layerName, (uint32_t)propertiesArray.size(), &count, propertiesArray.data());
+            propertiesArray.resize(XR_SUCCEEDED(result) ? count : 0);
+        }
+        return result;
+    }
+
+    // Query the extensions that the runtime implements, before applying our rules. As an API layer, the loader does
+    // not route the enumeration through us, so we resolve it from the next layer once it is known.
+    XrResult getRuntimeExtensions(std::vector<XrExtensionProperties>& propertiesArray) {
+        PFN_xrEnumerateInstanceExtensionProperties enumerate = next_xrEnumerateInstanceExtensionProperties;
+        if (!enumerate) {
+            PFN_xrVoidFunction function = nullptr;
+            const XrResult result =
+                next_xrGetInstanceProcAddr(XR_NULL_HANDLE, "xrEnumerateInstanceExtensionProperties", &function);
+            if (XR_FAILED(result)) {
+                return result;
+            }
+            enumerate = reinterpret_cast<PFN_xrEnumerateInstanceExtensionProperties>(function);
+        }
+        return enumerateExtensions(enumerate, nullptr, propertiesArray);
+    }
+
+    // Query the real list of extensions and apply our rules to it.
+    XrResult getMaskedExtensions(const char* layerName, std::vector<XrExtensionProperties>& propertiesArray) {
+        std::vector<XrExtensionProperties> runtimeProperties;
+        const XrResult result =
+            enumerateExtensions(next_xrEnumerateInstanceExtensionProperties, layerName, runtimeProperties);
+        if (XR_FAILED(result)) {
+            return result;
+        }
+
+        // Build the edited list in a single pass, preserving the order of the extensions.
+        const uint32_t count = (uint32_t)runtimeProperties.size();
+        const ExtensionRules& rules = getExtensionRules(layerName);
+        propertiesArray.clear();
+        propertiesArray.reserve(count);
+        for (uint32_t i = 0; i < count; i++) {
+            const XrExtensionProperties& properties = runtimeProperties[i];
+            if (rules.isMasked(properties.extensionName)) {
+                continue;
+            }
+            propertiesArray.push_back(properties);
+            propertiesArray.back().next = nullptr;
+
+            // Rewrite the advertised version.
+            const ExtensionVersionRule* const versionRule = rules.findVersionRule(properties.extensionName);
+            if (versionRule) {
+                propertiesArray.back().extensionVersion = versionRule->apply(properties.extensionVersion);
+                Log("Advertising extension %s as version %u (runtime version %u)\n",
+                    properties.extensionName,
+                    propertiesArray.back().extensionVersion,
+                    properties.extensionVersion);
+                if (propertiesArray.back().extensionVersion > properties.extensionVersion) {
+                    Log("Extension %s is advertised with a newer version than the runtime implements\n",
+                        properties.extensionName);
+                }
+            }
+        }
+
+        if (!layerName && synthesizeVisibilityMask &&
+            std::none_of(runtimeProperties.cbegin(),
+                         runtimeProperties.cend(),
+                         [](const XrExtensionProperties& properties) {
+                             return isSameExtensionName(properties.extensionName, visibilityMaskExtensionName);
+                         })) {
+            XrExtensionProperties properties{XR_TYPE_EXTENSION_PROPERTIES};
+            memcpy(properties.extensionName, visibilityMaskExtensionName.name, sizeof(properties.extensionName));
+            properties.extensionVersion = XR_KHR_visibility_mask_SPEC_VERSION;
+            propertiesArray.push_back(properties);
+            isVisibilityMaskSynthesized = true;
+            Log("Advertising synthesized extension %s\n", properties.extensionName);
+        }
+
+        if (!layerName && dynamicResolution) {
+            XrExtensionProperties properties{XR_TYPE_EXTENSION_PROPERTIES};
+            memcpy(properties.extensionName, dynamicResolutionExtensionName.name, sizeof(properties.extensionName));
+            properties.extensionVersion = XR_MBUCCHIA_dynamic_resolution_SPEC_VERSION;
+            propertiesArray.push_back(properties);
+            Log("Advertising extension %s\n", properties.extensionName);
+        }
+
+        return XR_SUCCESS;
+    }
+
+    // Get the masked list of extensions, from our snapshot when possible.
+    XrResult getExtensionSnapshot(const char* layerName, const std::vector<XrExtensionProperties>*& propertiesArray) {
+        const std::string_view snapshotName = layerName ? layerName : "";
+        {
+            std::unique_lock lock(extensionSnapshotsMutex);
+            const auto it = extensionSnapshots.find(snapshotName);
+            if (it != extensionSnapshots.cend()) {
+                propertiesArray = &it->second;
+                return XR_SUCCESS;
+            }
+        }
+
+        std::vector<XrExtensionProperties> newPropertiesArray;
+        const XrResult result = getMaskedExtensions(layerName, newPropertiesArray);
+        if (XR_FAILED(result)) {
+            // Do not remember errors, such as an unknown layer.
+            return result;
+        }
+
+        // Another thread might have raced us, in which case we keep the first snapshot.
+        std::unique_lock lock(extensionSnapshotsMutex);
+        propertiesArray =
+            &extensionSnapshots.try_emplace(std::string(snapshotName), std::move(newPropertiesArray)).first->second;
+        return XR_SUCCESS;
+    }
+
+    // Our own implementation of the instance extensions enumeration, so we can mask certain extensions.
+    // https://www.khronos.org/registry/OpenXR/specs/1.0/html/xrspec.html#xrEnumerateInstanceExtensionProperties
+    XrResult XRAPI_CALL xrEnumerateInstanceExtensionProperties(const char* layerName,
+                                                               uint32_t propertyCapacityInput,
+                                                               uint32_t* propertyCountOutput,
+                                                               XrExtensionProperties* properties) {
+        // Because we alter the number of extensions, we cannot let the runtime handle the two-call idiom.
+        const std::vector<XrExtensionProperties>* propertiesArray = nullptr;
+        const XrResult result = getExtensionSnapshot(layerName, propertiesArray);
+        if (XR_FAILED(result)) {
+            return result;
+        }
+
+        // Always return the adjusted count.
+        *propertyCountOutput = (uint32_t)propertiesArray->size();
+        if (propertyCapacityInput) {
+            if (propertyCapacityInput < *propertyCountOutput) {
+                return XR_ERROR_SIZE_INSUFFICIENT;
+            }
+
+            // Output the edited list, leaving the application's structure chains untouched.
+            for (uint32_t i = 0; i < *propertyCountOutput; i++) {
+                memcpy(properties[i].extensionName,
+                       (*propertiesArray)[i].extensionName,
+                       sizeof(properties[i].extensionName));
+                properties[i].extensionVersion = (*propertiesArray)[i].extensionVersion;
+            }
+        }
+
+        return XR_SUCCESS;
+    }
+
+    // Find a function in the table of the instance, resolving it through the runtime if needed.
+    XrResult resolveInstanceFunction(XrInstance instance,
+                                     uint64_t nameHash,
+                                     const char* name,
+                                     PFN_xrVoidFunction* function) {
+        if (instance != XR_NULL_HANDLE) {
+            std::shared_lock lock(instancesMutex);
+            const auto it = instanceFunctions.find(instance);
+            if (it != instanceFunctions.cend()) {
+                const auto cached = it->second.find(nameHash);
+                if (cached != it->second.cend() && cached->second) {
+                    *function = cached->second;
+                    return XR_SUCCESS;
+                }
+            }
+        }
+
+        const XrResult result = next_xrGetInstanceProcAddr(instance, name, function);
+        if (XR_SUCCEEDED(result) && *function && instance != XR_NULL_HANDLE) {
+            std::unique_lock lock(instancesMutex);
+            const auto it = instanceFunctions.find(instance);
+            if (it != instanceFunctions.end()) {
+                it->second.insert_or_assign(nameHash, *function);
+            }
+        }
+
+        return result;
+    }
+
+    void configureFrameThread() {
+        if (!frameThreadPriority && !frameThreadAffinity && frameThreadTask.empty()) {
+            return;
+        }
+        thread_local bool isConfigured = false;
+        if (isConfigured) {
+            return;
+        }
+        isConfigured = true;
+
+        const DWORD threadId = GetCurrentThreadId();
+        if (frameThreadPriority && !SetThreadPriority(GetCurrentThread(), *frameThreadPriority)) {
+            Log("Failed to set the priority of thread %u: %u\n", threadId, GetLastError());
+        }
+        if (frameThreadAffinity && !SetThreadAffinityMask(GetCurrentThread(), frameThreadAffinity)) {
+            Log("Failed to set the affinity of thread %u: %u\n", threadId, GetLastError());
+        }
+        if (!frameThreadTask.empty()) {
+            // The thread leaves the task when it exits.
+            DWORD taskIndex = 0;
+            if (!AvSetMmThreadCharacteristicsW(frameThreadTask.data(), &taskIndex)) {
+                Log("Failed to join MMCSS task `%ls' on thread %u: %u\n",
+                    frameThreadTask.data(),
+                    threadId,
+                    GetLastError());
+            }
+        }
+        Log("Configured frame thread %u\n", threadId);
+    }
+
+    void configureBackgroundThread() {
+        if (!efficientBackgroundThreads) {
+            return;
+        }
+        THREAD_POWER_THROTTLING_STATE state{};
+        state.Version = THREAD_POWER_THROTTLING_CURRENT_VERSION;
+        state.ControlMask = THREAD_POWER_THROTTLING_EXECUTION_SPEED;
+        state.StateMask = THREAD_POWER_THROTTLING_EXECUTION_SPEED;
+        if (!SetThreadInformation(GetCurrentThread(), ThreadPowerThrottling, &state, sizeof(state))) {
+            Log("Failed to enable efficiency mode on thread %u: %u\n", GetCurrentThreadId(), GetLastError());
+        }
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+    }
+
+    // Whether to log the calls to the runtime that run for longer than this many milliseconds (0 to disable).
+    uint32_t hangWatchdogThreshold = 0;
+    CallWatchdog callWatchdog;
+
+    // The number of calls to the runtime to keep per thread in our flight recorder file (0 to disable), for the
+    // diagnostic of crashes and hangs. Each process has its own file, created with its first instance, and the next
+    // process to create an instance reads and deletes it. Up to FlightRecorderThreads threads alive at the same time
+    // are recorded.
+    uint32_t flightRecorderSize = 0;
+    constexpr uint32_t FlightRecorderThreads = 32;
+
+    // The room for the serialized arguments of each call in the flight recorder file, in bytes (0 to not capture
+    // them).
+    uint32_t flightRecorderArguments = 0;
+    FlightRecorder flightRecorder;
+
+    // Whether to log the arguments of the calls to the runtime that run for longer than this many milliseconds (0 to
+    // disable), and the same threshold in performance counter ticks.
+    uint32_t slowCallThreshold = 0;
+    int64_t slowCallThresholdTicks = 0;
+    SlowCallLogger slowCallLogger;
+
+    std::string getResultName(XrResult result) {
+        const char* const name = serializer::getResultName(result);
+        return name ? name : std::to_string(result);
+    }
+
+    // Runs on the slow call logger thread. The arguments were serialized after the call returned, so that the output
+    // structures are included. The lines are split to fit in the buffer of Log().
+    void logSlowCall(const SlowCallLogger::Call& call) {
+        constexpr size_t MaxLineLength = 900;
+        if (call.droppedCount) {
+            Log("%u slow calls were not logged\n", call.droppedCount);
+        }
+        Log("%s took %.1f ms and returned %s\n", call.name, call.milliseconds, getResultName(call.result).c_str());
+        StructReader reader(call.arguments, call.size);
+        for (size_t i = 1; !reader.isAtEnd(); i++) {
+            const std::string argument = renderSerializedValue(reader);
+            for (size_t offset = 0; offset < argument.size(); offset += MaxLineLength) {
+                Log("  %s #%zu%s %.*s\n",
+                    call.name,
+                    i,
+                    offset ? "+" : ":",
+                    (int)std::min(MaxLineLength, argument.size() - offset),
+                    argument.c_str() + offset);
+            }
+        }
+    }
+
+    void reportHangingCall(const char* name, uint32_t threadId, double milliseconds, bool hasReturned) {
+        if (hasReturned) {
+            Log("%s returned on thread %u after at most %.0f ms\n", name, threadId, milliseconds);
+        } else {
+            Log("%s has been running on thread %u for %.0f ms\n", name, threadId, milliseconds);
+        }
+    }
+
+    // The runtime's implementation of a function that we hook after instance creation. The pointer initially targets a
+    // trampoline that resolves the function on first call and patches the pointer with an atomic store. In eager mode,
+    // all the pointers are patched at instance creation instead.
+    class NextFunctionBase {
+      public:
+        NextFunctionBase(const char* name, PFN_xrVoidFunction trampoline)
+            : m_name(name), m_nameHash(hashName(name)), m_trampoline(trampoline), m_function(trampoline),
+              m_nextInList(s_list) {
+            s_list = this;
+        }
+
+        uint64_t nameHash() const {
+            return m_nameHash;
+        }
+
+        // Patch the pointer with the runtime's implementation. Returns nullptr if the runtime does not implement it.
+        PFN_xrVoidFunction resolve(XrInstance instance) {
+            const auto start = std::chrono::high_resolution_clock::now();
+            PFN_xrVoidFunction function = nullptr;
+            if (XR_FAILED(resolveInstanceFunction(instance, m_nameHash, m_name, &function))) {
+                function = nullptr;
+            }
+            if (function) {
+                patch(function);
+            }
+            if (lazyResolution) {
+                const auto duration = std::chrono::high_resolution_clock::now() - start;
+                lazyResolutionCount++;
+                lazyResolutionTime += std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+            }
+            return function;
+        }
+
+        void patch(PFN_xrVoidFunction function) {
+            m_function.store(function, std::memory_order_release);
+        }
+
+        // Go back to the trampoline.
+        void reset() {
+            m_function.store(m_trampoline, std::memory_order_release);
+        }
+
+        template <typename Callback>
+        static void forEach(Callback&& callback) {
+            for (NextFunctionBase* next = s_list; next; next = next->m_nextInList) {
+                callback(*next);
+            }
+        }
+
+      protected:
+        const char* const m_name;
+        const uint64_t m_nameHash;
+        const PFN_xrVoidFunction m_trampoline;
+        std::atomic<PFN_xrVoidFunction> m_function;
+
+      private:
+        NextFunctionBase* const m_nextInList;
+        static inline NextFunctionBase* s_list = nullptr;
+    };
+
+    template <typename PFN>
+    class NextFunction;
+    template <typename... Args>
+    class NextFunction<XrResult(XRAPI_PTR*)(Args...)> : public NextFunctionBase {
+        using PFN = XrResult(XRAPI_PTR*)(Args...);
+
+      public:
+        using NextFunctionBase::NextFunctionBase;
+
+        XrResult operator()(Args... args) const {
+            const CallWatchdog::Scope scope(callWatchdog, m_name);
+            FlightRecorder::Record record(flightRecorder, m_nameHash);
+            record.setArguments(args...);
+            LARGE_INTEGER start{};
+            if (slowCallThresholdTicks) {
+                QueryPerformanceCounter(&start);
+            }
+            const XrResult result = reinterpret_cast<PFN>(m_function.load(std::memory_order_acquire))(args...);
+            record.setResult(result);
+            if (slowCallThresholdTicks) {
+                LARGE_INTEGER end;
+                QueryPerformanceCounter(&end);
+                const int64_t duration = end.QuadPart - start.QuadPart;
+                if (duration > slowCallThresholdTicks) {
+                    slowCallLogger.queue(m_name, duration * 1000.0 / performanceCounterFrequency, result, args...);
+                }
+            }
+            return result;
+        }
+
+        template <NextFunction* Self>
+        static XrResult XRAPI_CALL trampoline(Args... args) {
+            const PFN function = reinterpret_cast<PFN>(Self->resolve(currentInstance.load()));
+            if (!function) {
+                return XR_ERROR_FUNCTION_UNSUPPORTED;
+            }
+            return function(args...);
+        }
+    };
+
+#define NEXT_FUNCTION(name)                                                                                            \
+    NextFunction<PFN_##name> next_##name(                                                                              \
+        #name, reinterpret_cast<PFN_xrVoidFunction>(NextFunction<PFN_##name>::trampoline<&next_##name>))
+
+    NEXT_FUNCTION(xrDestroyInstance);
+    NEXT_FUNCTION(xrGetInstanceProperties);
+    NEXT_FUNCTION(xrGetSystemProperties);
+    NEXT_FUNCTION(xrPollEvent);
+    NEXT_FUNCTION(xrCreateSession);
+    NEXT_FUNCTION(xrBeginSession);
+    NEXT_FUNCTION(xrEndSession);
+    NEXT_FUNCTION(xrDestroySession);
+    NEXT_FUNCTION(xrGetVisibilityMaskKHR);
+    NEXT_FUNCTION(xrLocateViews);
+    NEXT_FUNCTION(xrCreateReferenceSpace);
+    NEXT_FUNCTION(xrCreateActionSpace);
+    NEXT_FUNCTION(xrDestroySpace);
+    NEXT_FUNCTION(xrLocateHandJointsEXT);
+    NEXT_FUNCTION(xrDestroyHandTrackerEXT);
+    NEXT_FUNCTION(xrWaitFrame);
+    NEXT_FUNCTION(xrBeginFrame);
+    NEXT_FUNCTION(xrEndFrame);
+    NEXT_FUNCTION(xrLocateSpace);
+    NEXT_FUNCTION(xrAcquireSwapchainImage);
+    NEXT_FUNCTION(xrWaitSwapchainImage);
+    NEXT_FUNCTION(xrReleaseSwapchainImage);
+#ifdef XR_USE_GRAPHICS_API_VULKAN
+    NEXT_FUNCTION(xrGetVulkanInstanceExtensionsKHR);
+    NEXT_FUNCTION(xrGetVulkanDeviceExtensionsKHR);
+    NEXT_FUNCTION(xrCreateVulkanInstanceKHR);
+    NEXT_FUNCTION(xrCreateVulkanDeviceKHR);
+#endif
+    NEXT_FUNCTION(xrConvertWin32PerformanceCounterToTimeKHR);
+    NEXT_FUNCTION(xrConvertTimeToWin32PerformanceCounterKHR);
+    NEXT_FUNCTION(xrPerfSettingsSetPerformanceLevelEXT);
+    NEXT_FUNCTION(xrEnumerateDisplayRefreshRatesFB);
+    NEXT_FUNCTION(xrRequestDisplayRefreshRateFB);
+
+    const char* getPerformanceLevelName(XrPerfSettingsLevelEXT level) {
+        switch (level) {
+        case XR_PERF_SETTINGS_LEVEL_POWER_SAVINGS_EXT:
+            return "powerSavings";
+        case XR_PERF_SETTINGS_LEVEL_SUSTAINED_LOW_EXT:
+            return "sustainedLow";
+        case XR_PERF_SETTINGS_LEVEL_SUSTAINED_HIGH_EXT:
+            return "sustainedHigh";
+        case XR_PERF_SETTINGS_LEVEL_BOOST_EXT:
+            return "boost";
+        default:
+            return "unknown";
+        }
+    }
+
+    // The performance levels for an application: its own profile, with the levels it does not specify from the
+    // [runtime] section.
+    PerformanceProfile getPerformanceProfile(std::string_view applicationName) {
+        PerformanceProfile profile = defaultPerformanceProfile;
+        for (const auto& [name, appProfile] : appPerformanceProfiles) {
+            if (name != applicationName) {
+                continue;
+            }
+            Log("Using the performance profile for application `%.*s'\n", (int)name.size(), name.data());
+            if (appProfile.cpuLevel) {
+                profile.cpuLevel = appProfile.cpuLevel;
+            }
+            if (appProfile.gpuLevel) {
+                profile.gpuLevel = appProfile.gpuLevel;
+            }
+            if (appProfile.displayRefreshRate) {
+                profile.displayRefreshRate = appProfile.displayRefreshRate;
+            }
+            break;
+        }
+        return profile;
+    }
+
+    // Check the extensions requested by the application against what we advertised, and build the list of extensions
+    // to enable on the runtime.
+    XrResult filterEnabledExtensions(const XrInstanceCreateInfo& createInfo,
+                                     std::vector<const char*>& enabledExtensionNames,
+                                     ImplementedExtensions& enabledImplementedExtensions) {
+        // There is no snapshot when we are an API layer, since the loader does not let us see the enumeration.
+        const std::vector<XrExtensionProperties>* propertiesArray = nullptr;
+        if (next_xrEnumerateInstanceExtensionProperties) {
+            getExtensionSnapshot(nullptr, propertiesArray);
+        }
+
+        for (uint32_t i = 0; i < createInfo.enabledExtensionCount; i++) {
+            // The application's strings are not padded to the fixed width that our comparisons read.
+            const ExtensionName extensionName = makeExtensionName(createInfo.enabledExtensionNames[i]);
+            if (runtimeRules.isMasked(extensionName.name)) {
+#ifdef WRAPPER_API_LAYER
+                // The loader does not let API layers edit the list of extensions that the application sees, so the
+                // application may legitimately request a masked extension. It must still not reach the runtime.
+                Log("Not enabling masked extension %s\n", extensionName.name);
+                continue;
+#else
+                Log("Application requested masked extension %s\n", extensionName.name);
+                return XR_ERROR_EXTENSION_NOT_PRESENT;
+#endif
+            }
+
+            // XrInstanceCreateInfo only carries extension names, so there is no version from the application to
+            // validate. We can only log which version we advertised, to help diagnose an application that rejected it.
+            if (propertiesArray && runtimeRules.findVersionRule(extensionName.name)) {
+                const auto it = std::find_if(propertiesArray->cbegin(),
+                                             propertiesArray->cend(),
+                                             [&extensionName](const XrExtensionProperties& properties) {
+                                                 return isSameExtensionName(properties.extensionName, extensionName);
+                                             });
+                if (it != propertiesArray->cend()) {
+                    Log("Application enabled extension %s, which was advertised as version %u\n",
+                        extensionName.name,
+                        it->extensionVersion);
+                }
+            }
+
+            // The runtime does not know about the extensions that we implement.
+            if (isVisibilityMaskSynthesized && isSameExtensionName(extensionName.name, visibilityMaskExtensionName)) {
+                enabledImplementedExtensions.visibilityMask = true;
+                continue;
+            }
+            if (dynamicResolution && isSameExtensionName(extensionName.name, dynamicResolutionExtensionName)) {
+                enabledImplementedExtensions.dynamicResolution = true;
+                continue;
+            }
+
+            enabledExtensionNames.push_back(createInfo.enabledExtensionNames[i]);
+        }
+
+        return XR_SUCCESS;
+    }
+
+    // Report the calls that were still in flight when a previous process ended without exiting cleanly, which point at
+    // a crash or a hang.
+    void logFlightRecord(const uint8_t* contents, size_t size) {
+        FlightRecorder::read(contents, size, [](const FlightRecorderHeader& header, const FlightRecorderRing& ring) {
+            if (header.isCleanExit) {
+                return;
+            }
+            const uint64_t oldest = ring.count > header.entryCount ? ring.count - header.entryCount : 0;
+            for (uint64_t i = ring.count; i > oldest; i--) {
+                const FlightRecorderEntry& entry = FlightRecorder::getEntry(header, ring, i - 1);
+                if (!entry.returnedAt) {
+                    Log("Process %u ended in a call to %s on thread %u\n",
+                        header.processId,
+                        findFunctionName(entry.nameHash),
+                        ring.threadId);
+                    StructReader reader(FlightRecorder::getArguments(entry),
+                                        std::min(entry.argumentsSize, header.argumentsCapacity));
+                    for (size_t j = 1; !reader.isAtEnd(); j++) {
+                        const std::string argument = renderSerializedValue(reader);
+                        Log("  #%zu: %.900s\n", j, argument.c_str());
+                    }
+                }
+            }
+        });
+    }
+
+    // Read and delete the flight recorder files of the previous processes. A process that is still running keeps its
+    // file open, so that our exclusive open fails and the file is left alone.
+    void logPreviousFlightRecords(const std::filesystem::path& directory) {
+        const std::wstring prefix = std::filesystem::path(std::string(PROJECTNAME) + ".").wstring();
+        std::error_code error;
+        for (const auto& file : std::filesystem::directory_iterator(directory, error)) {
+            const std::filesystem::path& path = file.path();
+            if (path.extension() != L".calls" || path.filename().wstring().rfind(prefix, 0) != 0) {
+                continue;
+            }
+            wil::unique_hfile handle(CreateFileW(path.c_str(),
+                                                 GENERIC_READ | DELETE,
+                                                 0,
+                                                 nullptr,
+                                                 OPEN_EXISTING,
+                                                 FILE_FLAG_DELETE_ON_CLOSE,
+                                                 nullptr));
+            LARGE_INTEGER size;
+            if (!handle || !GetFileSizeEx(handle.get(), &size) || !size.QuadPart) {
+                continue;
+            }
+            wil::unique_handle mapping(CreateFileMappingW(handle.get(), nullptr, PAGE_READONLY, 0, 0, nullptr));
+            if (!mapping) {
+                continue;
+            }
+            wil::unique_mapview_ptr<void> view(MapViewOfFile(mapping.get(), FILE_MAP_READ, 0, 0, 0));
+            if (view) {
+                logFlightRecord(static_cast<const uint8_t*>(view.get()), (size_t)size.QuadPart);
+            }
+        }
+    }
+
+    // Log the flight records of the previous processes and create ours. This is done at the first instance creation
+    // rather than when the DLL is loaded, since it scans a directory and maps files, which must not happen under the
+    // loader lock.
+    void openFlightRecorder() {
+        static std::once_flag once;
+        std::call_once(once, [] {
+            if (!flightRecorderSize) {
+                return;
+            }
+
+            const std::filesystem::path localAppData(getenv("LOCALAPPDATA"));
+            logPreviousFlightRecords(localAppData);
+
+            const std::filesystem::path flightRecorderPath =
+                localAppData / (std::string(PROJECTNAME) + "." + std::to_string(GetCurrentProcessId()) + ".calls");
+            uint32_t entryCount = 1;
+            while (entryCount < flightRecorderSize) {
+                entryCount *= 2;
+            }
+            if (!flightRecorder.open(flightRecorderPath,
+                                     FlightRecorderThreads,
+                                     entryCount,
+                                     flightRecorderArguments,
+                                     performanceCounterFrequency)) {
+                Log("Failed to create flight recorder `%ls': %u\n", flightRecorderPath.c_str(), GetLastError());
+            }
+        });
+    }
+
+    // Common implementation of instance creation, for both the runtime and the API layer entry points. The
+    // createNext() callback creates the instance further down the chain.
+    template <typename CreateNext>
+    XrResult createInstance(const XrInstanceCreateInfo* createInfo, XrInstance* instance, CreateNext&& createNext) {
+        if (!createInfo || createInfo->type != XR_TYPE_INSTANCE_CREATE_INFO) {
+            return XR_ERROR_VALIDATION_FAILURE;
+        }
+
+        openFlightRecorder();
+
+        std::vector<const char*> enabledExtensionNames;
+        ImplementedExtensions enabledImplementedExtensions;
+        XrResult result = filterEnabledExtensions(*createInfo, enabledExtensionNames, enabledImplementedExtensions);
+        if (XR_FAILED(result)) {
+            return result;
+        }
+
+        const auto isEnabled = [&enabledExtensionNames](const ExtensionName& extensionName) {
+            return std::any_of(
+                enabledExtensionNames.cbegin(), enabledExtensionNames.cend(), [&extensionName](const char* name) {
+                    return isSameExtensionName(makeExtensionName(name).name, extensionName);
+                });
+        };
+
+        const PerformanceProfile profile = getPerformanceProfile(createInfo->applicationInfo.applicationName);
+
+        // The extensions that we enable on behalf of the application only need the runtime to implement them, even
+        // when they are masked. As an API layer, this is the only place where we can see the runtime's extensions.
+        std::vector<XrExtensionProperties> runtimeExtensions;
+        if ((profile.cpuLevel || profile.gpuLevel || profile.displayRefreshRate) &&
+            XR_FAILED(getRuntimeExtensions(runtimeExtensions))) {
+            Log("Failed to enumerate the runtime's extensions\n");
+        }
+        const auto isSupported = [&runtimeExtensions](const ExtensionName& extensionName) {
+            return std::any_of(
+                runtimeExtensions.cbegin(),
+                runtimeExtensions.cend(),
+                [&extensionName](const XrExtensionProperties& properties) {
+                    return isSameExtensionName(properties.extensionName, extensionName);
+                });
+        };
+
+        bool enabledPerformanceSettings = false;
+        bool hiddenPerformanceSettings = false;
+        if (profile.cpuLevel || profile.gpuLevel) {
+            enabledPerformanceSettings = isEnabled(performanceSettingsExtensionName);
+            if (!enabledPerformanceSettings) {
+                // Enable the extension on behalf of the application when the runtime implements it.
+                if (isSupported(performanceSettingsExtensionName)) {
+                    enabledExtensionNames.push_back(XR_EXT_PERFORMANCE_SETTINGS_EXTENSION_NAME);
+                    enabledPerformanceSettings = hiddenPerformanceSettings = true;
+                } else {
+                    Log("Runtime does not support %s, ignoring performance levels\n",
+                        XR_EXT_PERFORMANCE_SETTINGS_EXTENSION_NAME);
+                }
+            }
+        }
+        bool enabledDisplayRefreshRate = false;
+        bool hiddenDisplayRefreshRate = false;
+        if (profile.displayRefreshRate) {
+            enabledDisplayRefreshRate = isEnabled(displayRefreshRateExtensionName);
+            if (!enabledDisplayRefreshRate) {
+                if (isSupported(displayRefreshRateExtensionName)) {
+                    enabledExtensionNames.push_back(XR_FB_DISPLAY_REFRESH_RATE_EXTENSION_NAME);
+                    enabledDisplayRefreshRate = hiddenDisplayRefreshRate = true;
+                } else {
+                    Log("Runtime does not support %s, ignoring display refresh rate\n",
+                        XR_FB_DISPLAY_REFRESH_RATE_EXTENSION_NAME);
+                }
+            }
+        }
+
+        XrInstanceCreateInfo chainCreateInfo = *createInfo;
+        chainCreateInfo.enabledExtensionCount = (uint32_t)enabledExtensionNames.size();
+        chainCreateInfo.enabledExtensionNames = enabledExtensionNames.data();
+        createInfo = &chainCreateInfo;
+
+        result = createNext(createInfo, instance);
+        if (XR_SUCCEEDED(result)) {
+            // Gather all the functions that the application might ask for.
+            std::vector<const FunctionName*> functionNames;
+            functionNames.push_back(coreFunctions);
+            for (uint32_t i = 0; i < createInfo->enabledExtensionCount; i++) {
+                const std::string_view extensionName = createInfo->enabledExtensionNames[i];
+                for (const auto& [name, extensionFunctionNames] : extensionFunctions) {
+                    if (name == extensionName) {
+                        functionNames.push_back(extensionFunctionNames);
+                        break;
+                    }
+                }
+            }
+
+            // Resolve them all now. Some runtimes do a linear search through hundreds of names for each lookup, so we
+            // only want to do this once.
+            const auto resolveAll = [&](std::unordered_map<uint64_t, PFN_xrVoidFunction>& functions) {
+                for (const FunctionName* functionName : functionNames) {
+                    for (; functionName->name; functionName++) {
+                        PFN_xrVoidFunction function = nullptr;
+                        if (XR_SUCCEEDED(next_xrGetInstanceProcAddr(*instance, functionName->name, &function)) &&
+                            function) {
+                            functions.insert_or_assign(functionName->hash, function);
+                        }
+                    }
+                }
+            };
+
+            std::unordered_map<uint64_t, PFN_xrVoidFunction> functions;
+            const auto start = std::chrono::high_resolution_clock::now();
+            if (!lazyResolution) {
+                resolveAll(functions);
+            } else {
+                // Only remember which functions are available.
+                for (const FunctionName* functionName : functionNames) {
+                    for (; functionName->name; functionName++) {
+                        functions.insert_or_assign(functionName->hash, nullptr);
+                    }
+                }
+            }
+            const auto duration = std::chrono::high_resolution_clock::now() - start;
+            Log("%s resolution of %zu functions took %.3f ms\n",
+                lazyResolution ? "Lazy" : "Eager",
+                functions.size(),
+                std::chrono::duration<double, std::milli>(duration).count());
+
+            if (benchmarkResolution && lazyResolution) {
+                std::unordered_map<uint64_t, PFN_xrVoidFunction> discarded;
+                const auto start = std::chrono::high_resolution_clock::now();
+                resolveAll(discarded);
+                const auto duration = std::chrono::high_resolution_clock::now() - start;
+                Log("Eager resolution of %zu functions would take %.3f ms\n",
+                    discarded.size(),
+                    std::chrono::duration<double, std::milli>(duration).count());
+            }
+
+            if (!lazyResolution) {
+                NextFunctionBase::forEach([&functions](NextFunctionBase& next) {
+                    const auto it = functions.find(next.nameHash());
+                    if (it != functions.cend()) {
+                        next.patch(it->second);
+                    }
+                });
+            }
+
+            {
+                std::unique_lock lock(instancesMutex);
+                instanceFunctions.insert_or_assign(*instance, std::move(functions));
+            }
+            callWatchdog.start(hangWatchdogThreshold * performanceCounterFrequency / 1000,
+                               performanceCounterFrequency,
+                               reportHangingCall,
+                               configureBackgroundThread);
+            if (slowCallThresholdTicks) {
+                slowCallLogger.start(logSlowCall, configureBackgroundThread);
+            }
+            implementedExtensions = enabledImplementedExtensions;
+            performanceProfile = profile;
+            isPerformanceSettingsEnabled = enabledPerformanceSettings;
+            isPerformanceSettingsHidden = hiddenPerformanceSettings;
+            isDisplayRefreshRateEnabled = enabledDisplayRefreshRate;
+            isDisplayRefreshRateHidden = hiddenDisplayRefreshRate;
+            currentInstance.store(*instance);
+            flightRecorder.setCleanExit(false);
+            lazyResolutionCount = 0;
+            lazyResolutionTime = 0;
+            extrapolatedHandJointsCount = 0;
+            handJointsQueryCount = 0;
+            handJointsQueryTime = 0;
+            sharedSpaceCount = 0;
+            asyncEndFrameCount = 0;
+            syncEndFrameCount = 0;
+            localTimeConversionCount = 0;
+            runtimeTimeConversionCount = 0;
+            timeCalibrationCount = 0;
+        }
+
+        return result;
+    }
+
+    // https://www.khronos.org/registry/OpenXR/specs/1.0/html/xrspec.html#xrCreateInstance
+    XrResult XRAPI_CALL xrCreateInstance(const XrInstanceCreateInfo* createInfo, XrInstance* instance) {
+        return createInstance(createInfo, instance, next_xrCreateInstance);
+    }
+
+#ifdef WRAPPER_API_LAYER
+    // When we are packaged as an API layer, the loader creates the instance through this function instead of
+    // xrCreateInstance().
+    XrResult XRAPI_CALL xrCreateApiLayerInstance(const XrInstanceCreateInfo* instanceCreateInfo,
+                                                 const XrApiLayerCreateInfo* apiLayerInfo,
+                                                 XrInstance* instance) {
+        if (!apiLayerInfo || apiLayerInfo->structType != XR_LOADER_INTERFACE_STRUCT_API_LAYER_CREATE_INFO ||
+            apiLayerInfo->structVersion != XR_API_LAYER_CREATE_INFO_STRUCT_VERSION ||
+            apiLayerInfo->structSize != sizeof(XrApiLayerCreateInfo) || !apiLayerInfo->nextInfo ||
+            apiLayerInfo->nextInfo->structType != XR_LOADER_INTERFACE_STRUCT_API_LAYER_NEXT_INFO ||
+            apiLayerInfo->nextInfo->structVersion != XR_API_LAYER_NEXT_INFO_STRUCT_VERSION ||
+            apiLayerInfo->nextInfo->structSize != sizeof(XrApiLayerNextInfo) ||
+            apiLayerInfo->nextInfo->layerName != std::string_view(LAYER_NAME) ||
+            !apiLayerInfo->nextInfo->nextGetInstanceProcAddr || !apiLayerInfo->nextInfo->nextCreateApiLayerInstance) {
+            Log("xrCreateApiLayerInstance validation failed\n");
+            return XR_ERROR_INITIALIZATION_FAILED;
+        }
+
+        // Remember where the next layer's xrGetInstanceProcAddr() is. All our hooks resolve through it.
+        next_xrGetInstanceProcAddr = apiLayerInfo->nextInfo->nextGetInstanceProcAddr;
+
+        return createInstance(
+            instanceCreateInfo, instance, [apiLayerInfo](const XrInstanceCreateInfo* createInfo, XrInstance* instance) {
+                // Skip ourselves in the chain.
+                XrApiLayerCreateInfo chainApiLayerInfo = *apiLayerInfo;
+                chainApiLayerInfo.nextInfo = apiLayerInfo->nextInfo->next;
+                return apiLayerInfo->nextInfo->nextCreateApiLayerInstance(createInfo, &chainApiLayerInfo, instance);
+            });
+    }
+#endif
+
+    // https://www.khronos.org/registry/OpenXR/specs/1.0/html/xrspec.html#xrDestroyInstance
+    XrResult XRAPI_CALL xrDestroyInstance(XrInstance instance) {
+        if (instance == currentInstance.load()) {
+            frameSubmissionThread.stop();
+            callWatchdog.stop();
+            slowCallLogger.stop();
+        }
+
+        const XrResult result = next_xrDestroyInstance(instance);
+        if (instance == currentInstance.load()) {
+            // Most applications exit right after destroying their instance, and might not unload us cleanly.
+            flightRecorder.setCleanExit(true);
+        }
+
+        if (lazyResolution) {
+            Log("Lazily resolved %u functions in %.3f ms\n",
+                lazyResolutionCount.load(),
+                lazyResolutionTime.load() / 1e6);
+        }
+        if (extrapolatedHandJointsCount && handJointsQueryCount) {
+            const double averageQueryTime = (double)handJointsQueryTime.load() / handJointsQueryCount.load();
+            Log("Extrapolated %u hand joints queries and sent %u to the runtime, saving about %.3f ms\n",
+                extrapolatedHandJointsCount.load(),
+                handJointsQueryCount.load(),
+                extrapolatedHandJointsCount.load() * averageQueryTime / 1e6);
+        }
+        if (sharedSpaceCount) {
+            Log("Shared %u spaces instead of creating them\n", sharedSpaceCount.load());
+        }
+        if (asyncEndFrameCount) {
+            Log("Submitted %u frames asynchronously and %u synchronously\n",
+                asyncEndFrameCount.load(),
+                syncEndFrameCount.load());
+        }
+        if (localTimeConversionCount || runtimeTimeConversionCount) {
+            Log("Converted %u timestamps locally and %u through the runtime, with %u calibrations\n",
+                localTimeConversionCount.load(),
+                runtimeTimeConversionCount.load(),
+                timeCalibrationCount.load());
+        }
+
+        {
+            std::unique_lock lock(instancesMutex);
+            instanceFunctions.erase(instance);
+        }
+        {
+            std::unique_lock lock(instanceCachesMutex);
+            instanceCaches.erase(instance);
+        }
+        XrInstance expected = instance;
+        if (currentInstance.compare_exchange_strong(expected, XR_NULL_HANDLE)) {
+            // A new instance might have different function pointers.
+            NextFunctionBase::forEach([](NextFunctionBase& next) { next.reset(); });
+
+            implementedExtensions = {};
+            performanceProfile = {};
+            isPerformanceSettingsEnabled = isPerformanceSettingsHidden = false;
+            isDisplayRefreshRateEnabled = isDisplayRefreshRateHidden = false;
+
+            // The application may destroy its instance without destroying its sessions first, and the next instance
+            // may get the same handles for its own objects.
+            {
+                std::unique_lock lock(visibilityMasksMutex);
+                visibilityMasks.clear();
+                synthesizedVisibilityMasks.clear();
+            }
+            {
+                std::unique_lock lock(pendingEventsMutex);
+                pendingEvents.clear();
+            }
+            {
+                std::unique_lock lock(sharedSpacesMutex);
+                spacesByKey.clear();
+                sharedSpaces.clear();
+                destroyedSharedSpaces.clear();
+            }
+            {
+                std::unique_lock lock(handTrackersMutex);
+                handTrackers.clear();
+            }
+            {
+                std::unique_lock lock(performanceLevelsMutex);
+                performanceLevels.clear();
+            }
+            {
+                std::unique_lock lock(framesMutex);
+                dynamicResolutionController.reset(dynamicResolutionMinScale);
+                frameScales = {};
+                frameWaitCounter = 0;
+                lastFrameTime = 0;
+                refreshRateSelections.clear();
+                asyncEndFrameSessions.clear();
+            }
+
+            // A new instance might use a different time base.
+            std::unique_lock lock(timeCalibrationMutex);
+            performanceCounterMapping.clear();
+            timeCalibrationFailed = false;
+        }
+
+        return result;
+    }
+
+    // Whether a function is part of the core or an enabled extension, without resolving it.
+    bool isInstanceFunctionAvailable(XrInstance instance, uint64_t nameHash) {
+        std::shared_lock lock(instancesMutex);
+        const auto it = instanceFunctions.find(instance);
+        return it != instanceFunctions.cend() && it->second.count(nameHash);
+    }
+
+    // Return our hook for a function that the runtime implements. In lazy mode, the runtime's implementation is not
+    // resolved until the first call.
+    XrResult installHook(XrInstance instance,
+                         NextFunctionBase& next,
+                         PFN_xrVoidFunction hook,
+                         PFN_xrVoidFunction* function) {
+        if (lazyResolution ? !isInstanceFunctionAvailable(instance, next.nameHash()) : !next.resolve(instance)) {
+            *function = nullptr;
+            return XR_ERROR_FUNCTION_UNSUPPORTED;
+        }
+
+        *function = hook;
+        return XR_SUCCESS;
+    }
+
+    // https://www.khronos.org/registry/OpenXR/specs/1.0/html/xrspec.html#xrGetInstanceProperties
+    XrResult XRAPI_CALL xrGetInstanceProperties(XrInstance instance, XrInstanceProperties* instanceProperties) {
+        if (!cacheProperties || !instanceProperties || instanceProperties->type != XR_TYPE_INSTANCE_PROPERTIES) {
+            return next_xrGetInstanceProperties(instance, instanceProperties);
+        }
+
+        XrBaseOutStructure* const chain = reinterpret_cast<XrBaseOutStructure*>(instanceProperties);
+        {
+            std::shared_lock lock(instanceCachesMutex);
+            const auto it = instanceCaches.find(instance);
+            if (it != instanceCaches.cend() && it->second.instanceProperties.read(chain)) {
+                return XR_SUCCESS;
+            }
+        }
+
+        const XrResult result = next_xrGetInstanceProperties(instance, instanceProperties);
+        if (XR_SUCCEEDED(result)) {
+            std::unique_lock lock(instanceCachesMutex);
+            instanceCaches[instance].instanceProperties.write(chain);
+        }
+
+        return result;
+    }
+
+    // https://www.khronos.org/registry/OpenXR/specs/1.0/html/xrspec.html#xrGetSystemProperties
+    XrResult XRAPI_CALL xrGetSystemProperties(XrInstance instance,
+                                              XrSystemId systemId,
+                                              XrSystemProperties* properties) {
+        if (!cacheProperties || !properties || properties->type != XR_TYPE_SYSTEM_PROPERTIES) {
+            return next_xrGetSystemProperties(instance, systemId, properties);
+        }
+
+        XrBaseOutStructure* const chain = reinterpret_cast<XrBaseOutStructure*>(properties);
+        {
+            std::shared_lock lock(instanceCachesMutex);
+            const auto it = instanceCaches.find(instance);
+            if (it != instanceCaches.cend()) {
+                const auto cached = it->second.systemProperties.find(systemId);
+                if (cached != it->second.systemProperties.cend() && cached->second.read(chain)) {
+                    return XR_SUCCESS;
+                }
+            }
+        }
+
+        const XrResult result = next_xrGetSystemProperties(instance, systemId, properties);
+        if (XR_SUCCEEDED(result)) {
+            std::unique_lock lock(instanceCachesMutex);
+            instanceCaches[instance].systemProperties[systemId].write(chain);
+        }
+
+        return result;
+    }
+
+    void requestDisplayRefreshRate(XrSession session, float displayRefreshRate) {
+        const XrResult result = next_xrRequestDisplayRefreshRateFB(session, displayRefreshRate);
+        Log("Requesting display refresh rate of %.1f Hz: %d\n", displayRefreshRate, result);
+    }
+
+    // Request the configured refresh rate (the closest one that the runtime supports), or start at the highest rate
+    // and let xrEndFrame() pick one from the frame time.
+    void selectDisplayRefreshRate(XrSession session, float displayRefreshRate) {
+        uint32_t count = 0;
+        std::vector<float> refreshRates;
+        XrResult result = next_xrEnumerateDisplayRefreshRatesFB(session, 0, &count, nullptr);
+        if (XR_SUCCEEDED(result)) {
+            refreshRates.resize(count);
+            result = next_xrEnumerateDisplayRefreshRatesFB(session, count, &count, refreshRates.data());
+        }
+        if (XR_FAILED(result) || refreshRates.empty()) {
+            Log("Failed to enumerate display refresh rates: %d\n", result);
+            return;
+        }
+        std::sort(refreshRates.begin(), refreshRates.end());
+
+        if (displayRefreshRate > 0) {
+            requestDisplayRefreshRate(
+                session,
+                *std::min_element(refreshRates.cbegin(), refreshRates.cend(), [displayRefreshRate](float a, float b) {
+                    return std::abs(a - displayRefreshRate) < std::abs(b - displayRefreshRate);
+                }));
+        } else {
+            requestDisplayRefreshRate(session, refreshRates.back());
+            std::unique_lock lock(framesMutex);
+            refreshRateSelections[session].refreshRates = std::move(refreshRates);
+        }
+    }
+
+    // The highest refresh rate whose period fits the frame time with some headroom, or the lowest one.
+    float pickDisplayRefreshRate(const std::vector<float>& refreshRates, XrDuration frameTime) {
+        for (auto it = refreshRates.crbegin(); it != refreshRates.crend(); ++it) {
+            if (frameTime < 0.9 * 1e9 / *it) {
+                return *it;
+            }
+        }
+        return refreshRates.front();
+    }
+
+    // Whether the graphics binding of a session lets the runtime submit frames from another thread than the
+    // application's. With D3D11 and OpenGL, the runtime would use the application's immediate context (or GL context)
+    // at the same time as its render thread. With Vulkan, it would use the application's queue (see
+    // asyncEndFrameVulkan).
+    bool isAsyncEndFrameBinding(const void* chain) {
+        for (const XrBaseInStructure* entry = reinterpret_cast<const XrBaseInStructure*>(chain); entry;
+             entry = entry->next) {
+            if (entry->type == XR_TYPE_GRAPHICS_BINDING_D3D12_KHR ||
+                (asyncEndFrameVulkan && entry->type == XR_TYPE_GRAPHICS_BINDING_VULKAN_KHR)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // https://www.khronos.org/registry/OpenXR/specs/1.0/html/xrspec.html#xrCreateSession
+    XrResult XRAPI_CALL xrCreateSession(XrInstance instance,
+                                        const XrSessionCreateInfo* createInfo,
+                                        XrSession* session) {
+        const XrResult result = next_xrCreateSession(instance, createInfo, session);
+        if (XR_SUCCEEDED(result) && isDisplayRefreshRateEnabled && performanceProfile.displayRefreshRate) {
+            selectDisplayRefreshRate(*session, *performanceProfile.displayRefreshRate);
+        }
+        if (XR_SUCCEEDED(result) && asyncEndFrame) {
+            if (isAsyncEndFrameBinding(createInfo->next)) {
+                std::unique_lock lock(framesMutex);
+                asyncEndFrameSessions.insert(*session);
+            } else {
+                Log("Submitting frames synchronously, since the graphics API is not D3D12%s\n",
+                    asyncEndFrameVulkan ? " or Vulkan" : "");
+            }
+        }
+
+        return result;
+    }
+
+    void setPerformanceLevel(XrSession session, XrPerfSettingsDomainEXT domain, XrPerfSettingsLevelEXT level) {
+        const XrResult result = next_xrPerfSettingsSetPerformanceLevelEXT(session, domain, level);
+        Log("Setting %s performance level to %s: %d\n",
+            domain == XR_PERF_SETTINGS_DOMAIN_CPU_EXT ? "CPU" : "GPU",
+            getPerformanceLevelName(level),
+            result);
+    }
+
+    // https://www.khronos.org/registry/OpenXR/specs/1.0/html/xrspec.html#xrEndSession
+    XrResult XRAPI_CALL xrEndSession(XrSession session) {
+        frameSubmissionThread.drain();
+
+        return next_xrEndSession(session);
+    }
+
+    // https://www.khronos.org/registry/OpenXR/specs/1.0/html/xrspec.html#xrBeginSession
+    XrResult XRAPI_CALL xrBeginSession(XrSession session, const XrSessionBeginInfo* beginInfo) {
+        const XrResult result = next_xrBeginSession(session, beginInfo);
+        if (XR_SUCCEEDED(result) && isPerformanceSettingsEnabled) {
+            std::unique_lock lock(performanceLevelsMutex);
+            const PerformanceProfile& levels = performanceLevels[session] = performanceProfile;
+            if (levels.cpuLevel) {
+                setPerformanceLevel(session, XR_PERF_SETTINGS_DOMAIN_CPU_EXT, *levels.cpuLevel);
+            }
+            if (levels.gpuLevel) {
+                setPerformanceLevel(session, XR_PERF_SETTINGS_DOMAIN_GPU_EXT, *levels.gpuLevel);
+            }
+        }
+
+        return result;
+    }
+
+    // The notification does not say which session it is for, so we step down the levels of all sessions.
+    void handlePerformanceNotification(const XrEventDataPerfSettingsEXT& event) {
+        const char* const domainName = event.domain == XR_PERF_SETTINGS_DOMAIN_CPU_EXT ? "CPU" : "GPU";
+        Log("%s performance notification (sub-domain %d): level %d -> %d\n",
+            domainName,
+            event.subDomain,
+            event.fromLevel,
+            event.toLevel);
+        if (!stepDownPerformanceLevel || event.toLevel <= event.fromLevel) {
+            return;
+        }
+
+        std::unique_lock lock(performanceLevelsMutex);
+        for (auto& [session, levels] : performanceLevels) {
+            std::optional<XrPerfSettingsLevelEXT>& level =
+                event.domain == XR_PERF_SETTINGS_DOMAIN_CPU_EXT ? levels.cpuLevel : levels.gpuLevel;
+            if (!level || *level == XR_PERF_SETTINGS_LEVEL_POWER_SAVINGS_EXT) {
+                continue;
+            }
+            level = *level == XR_PERF_SETTINGS_LEVEL_BOOST_EXT           ? XR_PERF_SETTINGS_LEVEL_SUSTAINED_HIGH_EXT
+                    : *level == XR_PERF_SETTINGS_LEVEL_SUSTAINED_HIGH_EXT ? XR_PERF_SETTINGS_LEVEL_SUSTAINED_LOW_EXT
+                                                                          : XR_PERF_SETTINGS_LEVEL_POWER_SAVINGS_EXT;
+            setPerformanceLevel(session, event.domain, *level);
+        }
+    }
+
+    // https://www.khronos.org/registry/OpenXR/specs/1.0/html/xrspec.html#xrPollEvent
+    XrResult XRAPI_CALL xrPollEvent(XrInstance instance, XrEventDataBuffer* eventData) {
+        if (eventData && eventData->type == XR_TYPE_EVENT_DATA_BUFFER) {
+            std::unique_lock lock(pendingEventsMutex);
+            if (!pendingEvents.empty()) {
+                *eventData = pendingEvents.front();
+                pendingEvents.pop_front();
+                return XR_SUCCESS;
+            }
+        }
+
+        const void* const next = eventData ? eventData->next : nullptr;
+        while (true) {
+            const XrResult result = next_xrPollEvent(instance, eventData);
+            if (result != XR_SUCCESS) {
+                return result;
+            }
+
+            if (eventData->type == XR_TYPE_EVENT_DATA_VISIBILITY_MASK_CHANGED_KHR) {
+                const XrEventDataVisibilityMaskChangedKHR* const event =
+                    reinterpret_cast<const XrEventDataVisibilityMaskChangedKHR*>(eventData);
+
+                // Forget all the mask types for that view.
+                std::unique_lock lock(visibilityMasksMutex);
+                for (auto it = visibilityMasks.begin(); it != visibilityMasks.end();) {
+                    const auto& [session, viewConfigurationType, viewIndex, visibilityMaskType] = it->first;
+                    const bool isChanged = session == event->session &&
+                                           viewConfigurationType == event->viewConfigurationType &&
+                                           viewIndex == event->viewIndex;
+                    it = isChanged ? visibilityMasks.erase(it) : std::next(it);
+                }
+            } else if (eventData->type == XR_TYPE_EVENT_DATA_PERF_SETTINGS_EXT) {
+                handlePerformanceNotification(*reinterpret_cast<const XrEventDataPerfSettingsEXT*>(eventData));
+
+                // Do not deliver events for an extension that the application did not enable.
+                if (isPerformanceSettingsHidden) {
+                    eventData->type = XR_TYPE_EVENT_DATA_BUFFER;
+                    eventData->next = next;
+                    continue;
+                }
+            } else if (eventData->type == XR_TYPE_EVENT_DATA_DISPLAY_REFRESH_RATE_CHANGED_FB) {
+                const XrEventDataDisplayRefreshRateChangedFB* const event =
+                    reinterpret_cast<const XrEventDataDisplayRefreshRateChangedFB*>(eventData);
+                Log("Display refresh rate changed from %.1f Hz to %.1f Hz\n",
+                    event->fromDisplayRefreshRate,
+                    event->toDisplayRefreshRate);
+
+                if (isDisplayRefreshRateHidden) {
+                    eventData->type = XR_TYPE_EVENT_DATA_BUFFER;
+                    eventData->next = next;
+                    continue;
+                }
+            }
+
+            return result;
+        }
+    }
+
+    // https://www.khronos.org/registry/OpenXR/specs/1.0/html/xrspec.html#xrDestroySession
+    XrResult XRAPI_CALL xrDestroySession(XrSession session) {
+        frameSubmissionThread.drain();
+
+        const XrResult result = next_xrDestroySession(session);
+
+        {
+            std::unique_lock lock(framesMutex);
+            asyncEndFrameSessions.erase(session);
+        }
+
+        {
+            std::unique_lock lock(visibilityMasksMutex);
+            for (auto it = visibilityMasks.begin(); it != visibilityMasks.end();) {
+                it = std::get<XrSession>(it->first) == session ? visibilityMasks.erase(it) : std::next(it);
+            }
+            for (auto it = synthesizedVisibilityMasks.begin(); it != synthesizedVisibilityMasks.end();) {
+                it = std::get<XrSession>(it->first) == session ? synthesizedVisibilityMasks.erase(it) : std::next(it);
+            }
+        }
+        {
+            // Do not deliver events for a session that no longer exists.
+            const auto isForSession = [session](const XrEventDataBuffer& event) {
+                return event.type == XR_TYPE_EVENT_DATA_VISIBILITY_MASK_CHANGED_KHR &&
+                       reinterpret_cast<const XrEventDataVisibilityMaskChangedKHR&>(event).session == session;
+            };
+            std::unique_lock lock(pendingEventsMutex);
+            pendingEvents.erase(std::remove_if(pendingEvents.begin(), pendingEvents.end(), isForSession),
+                                pendingEvents.end());
+        }
+        {
+            std::unique_lock lock(performanceLevelsMutex);
+            performanceLevels.erase(session);
+        }
+        {
+            std::unique_lock lock(framesMutex);
+            if (dynamicResolutionController.frameCount()) {
+                Log("Rendered %u frames at an average resolution scale of %.2f\n",
+                    dynamicResolutionController.frameCount(),
+                    dynamicResolutionController.averageScale());
+            }
+            dynamicResolutionController.reset(dynamicResolutionMinScale);
+            frameScales = {};
+            refreshRateSelections.erase(session);
+        }
+        {
+            // The runtime destroys the spaces of the session with it.
+            std::unique_lock lock(sharedSpacesMutex);
+            for (auto it = sharedSpaces.begin(); it != sharedSpaces.end();) {
+                if (std::get<XrSession>(it->second.key) == session) {
+                    spacesByKey.erase(it->second.key);
+                    it = sharedSpaces.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            for (auto it = destroyedSharedSpaces.begin(); it != destroyedSharedSpaces.end();) {
+                it = it->second == session ? destroyedSharedSpaces.erase(it) : std::next(it);
+            }
+        }
+
+        return result;
+    }
+
+    // Output a visibility mask with the two-call idiom.
+    XrResult writeVisibilityMask(const VisibilityMask& mask, XrVisibilityMaskKHR* visibilityMask) {
+        visibilityMask->vertexCountOutput = (uint32_t)mask.vertices.size();
+        visibilityMask->indexCountOutput = (uint32_t)mask.indices.size();
+        if ((visibilityMask->vertexCapacityInput &&
+             visibilityMask->vertexCapacityInput < visibilityMask->vertexCountOutput) ||
+            (visibilityMask->indexCapacityInput &&
+             visibilityMask->indexCapacityInput < visibilityMask->indexCountOutput)) {
+            return XR_ERROR_SIZE_INSUFFICIENT;
+        }
+        if (visibilityMask->vertexCapacityInput) {
+            std::copy(mask.vertices.cbegin(), mask.vertices.cend(), visibilityMask->vertices);
+        }
+        if (visibilityMask->indexCapacityInput) {
+            std::copy(mask.indices.cbegin(), mask.indices.cend(), visibilityMask->indices);
+        }
+        return XR_SUCCESS;
+    }
+
+    // https://www.khronos.org/registry/OpenXR/specs/1.0/html/xrspec.html#xrGetVisibilityMaskKHR
+    XrResult XRAPI_CALL xrGetVisibilityMaskKHR(XrSession session,
+                                               XrViewConfigurationType viewConfigurationType,
+                                               uint32_t viewIndex,
+                                               XrVisibilityMaskTypeKHR visibilityMaskType,
+                                               XrVisibilityMaskKHR* visibilityMask) {
+        if (!cacheVisibilityMasks || !visibilityMask || visibilityMask->type != XR_TYPE_VISIBILITY_MASK_KHR) {
+            return next_xrGetVisibilityMaskKHR(
+                session, viewConfigurationType, viewIndex, visibilityMaskType, visibilityMask);
+        }
+
+        const VisibilityMaskKey key{session, viewConfigurationType, viewIndex, visibilityMaskType};
+        {
+            std::shared_lock lock(visibilityMasksMutex);
+            const auto it = visibilityMasks.find(key);
+            if (it != visibilityMasks.cend()) {
+                return writeVisibilityMask(it->second, visibilityMask);
+            }
+        }
+
+        // Query the whole mask at once, so that we can answer both calls of the two-call idiom.
+        VisibilityMask mask;
+        XrVisibilityMaskKHR query{XR_TYPE_VISIBILITY_MASK_KHR};
+        XrResult result =
+            next_xrGetVisibilityMaskKHR(session, viewConfigurationType, viewIndex, visibilityMaskType, &query);
+        if (XR_SUCCEEDED(result)) {
+            mask.vertices.resize(query.vertexCountOutput);
+            mask.indices.resize(query.indexCountOutput);
+            query.vertexCapacityInput = query.vertexCountOutput;
+            query.vertices = mask.vertices.data();
+            query.indexCapacityInput = query.indexCountOutput;
+            query.indices = mask.indices.data();
+            result = next_xrGetVisibilityMaskKHR(session, viewConfigurationType, viewIndex, visibilityMaskType, &query);
+        }
+        if (result != XR_SUCCESS) {
+            // Let the runtime report the error (or whatever changed in between).
+            return next_xrGetVisibilityMaskKHR(
+                session, viewConfigurationType, viewIndex, visibilityMaskType, visibilityMask);
+        }
+
+        std::unique_lock lock(visibilityMasksMutex);
+        return writeVisibilityMask(visibilityMasks.insert_or_assign(key, std::move(mask)).first->second,
+                                   visibilityMask);
+    }
+
+    // https://www.khronos.org/registry/OpenXR/specs/1.0/html/xrspec.html#xrLocateViews
+    XrResult XRAPI_CALL xrLocateViews(XrSession session,
+                                      const XrViewLocateInfo* viewLocateInfo,
+                                      XrViewState* viewState,
+                                      uint32_t viewCapacityInput,
+                                      uint32_t* viewCountOutput,
+                                      XrView* views) {
+        const XrResult result =
+            next_xrLocateViews(session, viewLocateInfo, viewState, viewCapacityInput, viewCountOutput, views);
+        if (result != XR_SUCCESS || !viewCapacityInput || !implementedExtensions.visibilityMask) {
+            return result;
+        }
+
+        // Look for changes in the field of view of each view. This is called every frame, so only take the exclusive
+        // lock when something changed. The first field of view of a view is not a change, unless the application
+        // already asked for its mask and got an empty one.
+        const auto isSameFov = [](const XrFovf& a, const XrFovf& b) {
+            return std::abs(a.angleLeft - b.angleLeft) <= VisibilityMaskFovTolerance &&
+                   std::abs(a.angleRight - b.angleRight) <= VisibilityMaskFovTolerance &&
+                   std::abs(a.angleUp - b.angleUp) <= VisibilityMaskFovTolerance &&
+                   std::abs(a.angleDown - b.angleDown) <= VisibilityMaskFovTolerance;
+        };
+        std::vector<uint32_t> updatedViews;
+        std::vector<uint32_t> changedViews;
+        {
+            std::shared_lock lock(visibilityMasksMutex);
+            for (uint32_t i = 0; i < *viewCountOutput; i++) {
+                const auto it = synthesizedVisibilityMasks.find({session, viewLocateInfo->viewConfigurationType, i});
+                if (it == synthesizedVisibilityMasks.cend()) {
+                    updatedViews.push_back(i);
+                } else if (!it->second.isFovKnown || !isSameFov(it->second.fov, views[i].fov)) {
+                    updatedViews.push_back(i);
+                    changedViews.push_back(i);
+                }
+            }
+        }
+        if (updatedViews.empty()) {
+            return result;
+        }
+
+        {
+            std::unique_lock lock(visibilityMasksMutex);
+            for (const uint32_t i : updatedViews) {
+                synthesizedVisibilityMasks.insert_or_assign({session, viewLocateInfo->viewConfigurationType, i},
+                                                            SynthesizedVisibilityMask{views[i].fov, true});
+            }
+        }
+        if (!changedViews.empty()) {
+            // Tell the application to query the masks again, once per view until it polls the event.
+            std::unique_lock lock(pendingEventsMutex);
+            for (const uint32_t i : changedViews) {
+                const auto isSameEvent = [&](const XrEventDataBuffer& event) {
+                    const XrEventDataVisibilityMaskChangedKHR& pending =
+                        reinterpret_cast<const XrEventDataVisibilityMaskChangedKHR&>(event);
+                    return pending.type == XR_TYPE_EVENT_DATA_VISIBILITY_MASK_CHANGED_KHR &&
+                           pending.session == session &&
+                           pending.viewConfigurationType == viewLocateInfo->viewConfigurationType &&
+                           pending.viewIndex == i;
+                };
+                if (std::any_of(pendingEvents.cbegin(), pendingEvents.cend(), isSameEvent)) {
+                    continue;
+                }
+
+                XrEventDataBuffer event{};
+                XrEventDataVisibilityMaskChangedKHR& visibilityMaskChanged =
+                    reinterpret_cast<XrEventDataVisibilityMaskChangedKHR&>(event);
+                visibilityMaskChanged.type = XR_TYPE_EVENT_DATA_VISIBILITY_MASK_CHANGED_KHR;
+                visibilityMaskChanged.session = session;
+                visibilityMaskChanged.viewConfigurationType = viewLocateInfo->viewConfigurationType;
+                visibilityMaskChanged.viewIndex = i;
+                pendingEvents.push_back(event);
+            }
+        }
+
+        return result;
+    }
+
+    // Return an existing space created from the same key, or create a new one with createNext().
+    template <typename CreateNext>
+    XrResult createSharedSpace(const SpaceKey& key, XrSpace* space, CreateNext&& createNext) {
+        std::unique_lock lock(sharedSpacesMutex);
+        const auto it = spacesByKey.find(key);
+        if (it != spacesByKey.cend()) {
+            sharedSpaces[it->second].references++;
+            *space = it->second;
+            sharedSpaceCount++;
+            return XR_SUCCESS;
+        }
+
+        const XrResult result = createNext();
+        if (XR_SUCCEEDED(result)) {
+            spacesByKey.insert_or_assign(key, *space);
+            sharedSpaces.insert_or_assign(*space, SharedSpace{key, 1});
+            destroyedSharedSpaces.erase(*space);
+        }
+
+        return result;
+    }
+
+    // Create a space that is not shared. The runtime may reuse the handle of a shared space that was destroyed.
+    template <typename CreateNext>
+    XrResult createUnsharedSpace(XrSpace* space, CreateNext&& createNext) {
+        const XrResult result = createNext();
+        if (XR_SUCCEEDED(result) && shareSpaces && space) {
+            std::unique_lock lock(sharedSpacesMutex);
+            destroyedSharedSpaces.erase(*space);
+        }
+        return result;
+    }
+
+    std::array<float, 7> getPoseKey(const XrPosef& pose) {
+        return {pose.orientation.x,
+                pose.orientation.y,
+                pose.orientation.z,
+                pose.orientation.w,
+                pose.position.x,
+                pose.position.y,
+                pose.position.z};
+    }
+
+    // https://www.khronos.org/registry/OpenXR/specs/1.0/html/xrspec.html#xrCreateReferenceSpace
+    XrResult XRAPI_CALL xrCreateReferenceSpace(XrSession session,
+                                               const XrReferenceSpaceCreateInfo* createInfo,
+                                               XrSpace* space) {
+        // Chained inputs might make the spaces different.
+        if (!shareSpaces || !createInfo || createInfo->type != XR_TYPE_REFERENCE_SPACE_CREATE_INFO ||
+            createInfo->next || !space) {
+            return createUnsharedSpace(space,
+                                       [&]() { return next_xrCreateReferenceSpace(session, createInfo, space); });
+        }
+
+        const SpaceKey key{session,
+                           false,
+                           (uint64_t)createInfo->referenceSpaceType,
+                           XR_NULL_PATH,
+                           getPoseKey(createInfo->poseInReferenceSpace)};
+        return createSharedSpace(key, space, [&]() { return next_xrCreateReferenceSpace(session, createInfo, space); });
+    }
+
+    // https://www.khronos.org/registry/OpenXR/specs/1.0/html/xrspec.html#xrCreateActionSpace
+    XrResult XRAPI_CALL xrCreateActionSpace(XrSession session,
+                                            const XrActionSpaceCreateInfo* createInfo,
+                                            XrSpace* space) {
+        if (!shareSpaces || !createInfo || createInfo->type != XR_TYPE_ACTION_SPACE_CREATE_INFO || createInfo->next ||
+            !space) {
+            return createUnsharedSpace(space, [&]() { return next_xrCreateActionSpace(session, createInfo, space); });
+        }
+
+        const SpaceKey key{session,
+                           true,
+                           (uint64_t)createInfo->action,
+                           createInfo->subactionPath,
+                           getPoseKey(createInfo->poseInActionSpace)};
+        return createSharedSpace(key, space, [&]() { return next_xrCreateActionSpace(session, createInfo, space); });
+    }
+
+    // https://www.khronos.org/registry/OpenXR/specs/1.0/html/xrspec.html#xrDestroySpace
+    XrResult XRAPI_CALL xrDestroySpace(XrSpace space) {
+        {
+            std::unique_lock lock(sharedSpacesMutex);
+            const auto it = sharedSpaces.find(space);
+            if (it != sharedSpaces.end()) {
+                if (--it->second.references) {
+                    return XR_SUCCESS;
+                }
+                destroyedSharedSpaces.insert_or_assign(space, std::get<XrSession>(it->second.key));
+                spacesByKey.erase(it->second.key);
+                sharedSpaces.erase(it);
+            } else if (destroyedSharedSpaces.count(space)) {
+                // The application destroyed the space more times than it created it. The runtime already destroyed
+                // this handle, so it must not see it again.
+                Log("Shared space %p was destroyed more times than it was created\n", space);
+                return XR_ERROR_HANDLE_INVALID;
+            }
+        }
+
+        return next_xrDestroySpace(space);
+    }
+
+    // The calls below are only hooked when a diagnostic of the calls to the runtime is enabled (hang watchdog, flight
+    // recorder or slow-call log), so that it also sees the swapchain and space calls where applications often wait.
+    bool isCallDiagnosticEnabled() {
+        return hangWatchdogThreshold || flightRecorderSize || slowCallThreshold;
+    }
+
+    // https://www.khronos.org/registry/OpenXR/specs/1.0/html/xrspec.html#xrLocateSpace
+    XrResult XRAPI_CALL xrLocateSpace(XrSpace space, XrSpace baseSpace, XrTime time, XrSpaceLocation* location) {
+        return next_xrLocateSpace(space, baseSpace, time, location);
+    }
+
+    // https://www.khronos.org/registry/OpenXR/specs/1.0/html/xrspec.html#xrAcquireSwapchainImage
+    XrResult XRAPI_CALL xrAcquireSwapchainImage(XrSwapchain swapchain,
+                                                const XrSwapchainImageAcquireInfo* acquireInfo,
+                                                uint32_t* index) {
+        return next_xrAcquireSwapchainImage(swapchain, acquireInfo, index);
+    }
+
+    // https://www.khronos.org/registry/OpenXR/specs/1.0/html/xrspec.html#xrWaitSwapchainImage
+    XrResult XRAPI_CALL xrWaitSwapchainImage(XrSwapchain swapchain, const XrSwapchainImageWaitInfo* waitInfo) {
+        return next_xrWaitSwapchainImage(swapchain, waitInfo);
+    }
+
+    // https://www.khronos.org/registry/OpenXR/specs/1.0/html/xrspec.html#xrReleaseSwapchainImage
+    XrResult XRAPI_CALL xrReleaseSwapchainImage(XrSwapchain swapchain, const XrSwapchainImageReleaseInfo* releaseInfo) {
+        return next_xrReleaseSwapchainImage(swapchain, releaseInfo);
+    }
+
+    // https://www.khronos.org/registry/OpenXR/specs/1.0/html/xrspec.html#xrLocateHandJointsEXT
+    XrResult XRAPI_CALL xrLocateHandJointsEXT(XrHandTrackerEXT handTracker,
+                                              const XrHandJointsLocateInfoEXT* locateInfo,
+                                              XrHandJointLocationsEXT* locations) {
+        // Chained structures (such as the joint velocities) and other joint sets always go to the runtime.
+        const bool isRateLimited = handTrackingRate > 0 && locateInfo &&
+                                   locateInfo->type == XR_TYPE_HAND_JOINTS_LOCATE_INFO_EXT && !locateInfo->next &&
+                                   locations && locations->type == XR_TYPE_HAND_JOINT_LOCATIONS_EXT &&
+                                   !locations->next && locations->jointCount == HandJointsSample::JointCount &&
+                                   locations->jointLocations;
+
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        if (isRateLimited) {
+            std::unique_lock lock(handTrackersMutex);
+            const auto it = handTrackers.find(handTracker);
+            if (it != handTrackers.cend()) {
+                const HandTrackerState& state = it->second;
+                if (state.sampleCount == 2 && state.baseSpace == locateInfo->baseSpace &&
+                    now.QuadPart - state.lastQueryCounter < performanceCounterFrequency / handTrackingRate &&
+                    std::abs(locateInfo->time - state.samples[1].time) <= MaxHandJointsExtrapolation) {
+                    extrapolateHandJoints(state.samples[0], state.samples[1], locateInfo->time, *locations);
+                    extrapolatedHandJointsCount++;
+                    return XR_SUCCESS;
+                }
+            }
+        }
+
+        const XrResult result = next_xrLocateHandJointsEXT(handTracker, locateInfo, locations);
+        if (isRateLimited) {
+            LARGE_INTEGER end;
+            QueryPerformanceCounter(&end);
+            handJointsQueryCount++;
+            handJointsQueryTime += (end.QuadPart - now.QuadPart) * 1'000'000'000 / performanceCounterFrequency;
+
+            if (result == XR_SUCCESS) {
+                std::unique_lock lock(handTrackersMutex);
+                HandTrackerState& state = handTrackers[handTracker];
+                if (state.baseSpace != locateInfo->baseSpace) {
+                    state.baseSpace = locateInfo->baseSpace;
+                    state.sampleCount = 0;
+                }
+
+                // Keep the two latest samples, in chronological order.
+                if (state.sampleCount && locateInfo->time <= state.samples[state.sampleCount - 1].time) {
+                    if (locateInfo->time < state.samples[state.sampleCount - 1].time) {
+                        state.sampleCount = 0;
+                    } else {
+                        state.sampleCount--;
+                    }
+                }
+                if (state.sampleCount == 2) {
+                    state.samples[0] = state.samples[1];
+                    state.sampleCount = 1;
+                }
+                storeHandJoints(*locations, locateInfo->time, state.samples[state.sampleCount++]);
+                state.lastQueryCounter = now.QuadPart;
+            }
+        }
+
+        return result;
+    }
+
+    // https://www.khronos.org/registry/OpenXR/specs/1.0/html/xrspec.html#xrDestroyHandTrackerEXT
+    XrResult XRAPI_CALL xrDestroyHandTrackerEXT(XrHandTrackerEXT handTracker) {
+        {
+            std::unique_lock lock(handTrackersMutex);
+            handTrackers.erase(handTracker);
+        }
+
+        return next_xrDestroyHandTrackerEXT(handTracker);
+    }
+
+    // https://www.khronos.org/registry/OpenXR/specs/1.0/html/xrspec.html#xrWaitFrame
+    XrResult XRAPI_CALL xrWaitFrame(XrSession session, const XrFrameWaitInfo* frameWaitInfo, XrFrameState* frameState) {
+        configureFrameThread();
+
+        // The previous frame must reach the runtime first.
+        frameSubmissionThread.drain();
+
+        // The runtime does not know about our structure: take it out of the chain during the call.
+        XrBaseOutStructure* previous = nullptr;
+        XrDynamicResolutionScaleMBUCCHIA* dynamicResolutionScale = nullptr;
+        if (implementedExtensions.dynamicResolution && frameState) {
+            for (XrBaseOutStructure* entry = reinterpret_cast<XrBaseOutStructure*>(frameState); entry->next;
+                 entry = entry->next) {
+                if (entry->next->type == XR_TYPE_DYNAMIC_RESOLUTION_SCALE_MBUCCHIA) {
+                    previous = entry;
+                    dynamicResolutionScale = reinterpret_cast<XrDynamicResolutionScaleMBUCCHIA*>(entry->next);
+                    previous->next = entry->next->next;
+                    break;
+                }
+            }
+        }
+
+        const XrResult result = next_xrWaitFrame(session, frameWaitInfo, frameState);
+        if (dynamicResolutionScale) {
+            previous->next = reinterpret_cast<XrBaseOutStructure*>(dynamicResolutionScale);
+        }
+
+        if (XR_SUCCEEDED(result)) {
+            LARGE_INTEGER now;
+            QueryPerformanceCounter(&now);
+
+            std::unique_lock lock(framesMutex);
+            frameWaitCounter = now.QuadPart;
+            if (implementedExtensions.dynamicResolution) {
+                const float scale = dynamicResolutionController.update(
+                    frameState->predictedDisplayTime, frameState->predictedDisplayPeriod, lastFrameTime);
+
+                // Only rewrite the frames of an application that knows about the scale.
+                if (dynamicResolutionScale) {
+                    dynamicResolutionScale->scale = scale;
+                    frameScales[nextFrameScale++ % frameScales.size()] = {frameState->predictedDisplayTime, scale};
+                }
+            }
+        }
 
-    // The list of instance extensions to mask, loaded from our configuration file.
-    std::vector<std::string> extensionsToMask;
+        return result;
+    }
 
-    std::ofstream logStream;
+    // https://www.khronos.org/registry/OpenXR/specs/1.0/html/xrspec.html#xrBeginFrame
+    XrResult XRAPI_CALL xrBeginFrame(XrSession session, const XrFrameBeginInfo* frameBeginInfo) {
+        configureFrameThread();
 
-    // Basic logging function.
-    void Log(const char* fmt, ...) {
-        const std::time_t now = std::time(nullptr);
-        char buf[1024];
-        size_t offset = std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S %z: ", std::localtime(&now));
-        va_list va;
-        va_start(va, fmt);
-        vsnprintf_s(buf + offset, sizeof(buf) - offset, _TRUNCATE, fmt, va);
-        va_end(va);
+        frameSubmissionThread.drain();
 
-        OutputDebugStringA(buf);
-        if (logStream.is_open()) {
-            logStream << buf;
-            logStream.flush();
+        return next_xrBeginFrame(session, frameBeginInfo);
+    }
+
+    void scaleImageRect(XrRect2Di& imageRect, float scale) {
+        imageRect.extent.width = xrScaleImageExtentMBUCCHIA(imageRect.extent.width, scale);
+        imageRect.extent.height = xrScaleImageExtentMBUCCHIA(imageRect.extent.height, scale);
+    }
+
+    // Copy the frame submission into the arena, with the imageRect of the projection views (and of their depth) scaled.
+    // A projection layer is left unscaled when the chain of one of its views cannot be copied, since its color and
+    // depth must be scaled together and the application's structures are never edited.
+    const XrFrameEndInfo* scaleProjectionLayers(Arena& arena, const XrFrameEndInfo& frameEndInfo, float scale) {
+        XrFrameEndInfo* const scaledFrameEndInfo = arena.copy(frameEndInfo);
+        const XrCompositionLayerBaseHeader** const layers =
+            arena.copyArray<const XrCompositionLayerBaseHeader*>(frameEndInfo.layers, frameEndInfo.layerCount);
+        for (uint32_t i = 0; i < frameEndInfo.layerCount; i++) {
+            if (!layers[i] || layers[i]->type != XR_TYPE_COMPOSITION_LAYER_PROJECTION) {
+                continue;
+            }
+
+            const XrCompositionLayerProjection& source =
+                *reinterpret_cast<const XrCompositionLayerProjection*>(layers[i]);
+            XrCompositionLayerProjectionView* const views = arena.copyArray(source.views, source.viewCount);
+            bool isCopied = true;
+            for (uint32_t j = 0; j < source.viewCount && isCopied; j++) {
+                XrBaseOutStructure* chain = nullptr;
+                isCopied = copyWholeStructureChain(arena, views[j].next, chain);
+                views[j].next = chain;
+                scaleImageRect(views[j].subImage.imageRect, scale);
+                XrCompositionLayerDepthInfoKHR* const depthInfo = findInStructureChain<XrCompositionLayerDepthInfoKHR>(
+                    chain, XR_TYPE_COMPOSITION_LAYER_DEPTH_INFO_KHR);
+                if (depthInfo) {
+                    scaleImageRect(depthInfo->subImage.imageRect, scale);
+                }
+            }
+            if (!isCopied) {
+                continue;
+            }
+
+            XrCompositionLayerProjection* const projection = arena.copy(source);
+            projection->views = views;
+            layers[i] = reinterpret_cast<const XrCompositionLayerBaseHeader*>(projection);
         }
+        scaledFrameEndInfo->layers = layers;
+        return scaledFrameEndInfo;
     }
 
-    // Our own implementation of the instance extensions enumeration, so we can mask certain extensions.
-    // https://www.khronos.org/registry/OpenXR/specs/1.0/html/xrspec.html#xrEnumerateInstanceExtensionProperties
-    XrResult XRAPI_CALL xrEnumerateInstanceExtensionProperties(const char* layerName,
-                                                               uint32_t propertyCapacityInput,
-                                                               uint32_t* propertyCountOutput,
-                                                               XrExtensionProperties* properties) {
-        XrResult result;
-        if (!layerName) {
-            // Because we alter the number of extensions, we must always perform a first call to get the real number of
-            // extensions.
-            result = next_xrEnumerateInstanceExtensionProperties(nullptr, 0, propertyCountOutput, nullptr);
-            if (XR_SUCCEEDED(result)) {
-                // Query the real list of extensions.
-                std::vector<XrExtensionProperties> propertiesArray(*propertyCountOutput,
-                                                                   {XR_TYPE_EXTENSION_PROPERTIES});
-                result = next_xrEnumerateInstanceExtensionProperties(
-                    nullptr, (uint32_t)propertiesArray.size(), propertyCountOutput, propertiesArray.data());
-                if (XR_SUCCEEDED(result)) {
-                    // Mask out the desired extensions.
-                    for (const std::string& extensionToMask : extensionsToMask) {
-                        const auto it = std::find_if(propertiesArray.begin(),
-                                                     propertiesArray.end(),
-                                                     [&extensionToMask](const XrExtensionProperties& properties) {
-                                                         return properties.extensionName == extensionToMask;
-                                                     });
-                        if (it != propertiesArray.end()) {
-                            propertiesArray.erase(it);
-                        }
-                    }
+    // https://www.khronos.org/registry/OpenXR/specs/1.0/html/xrspec.html#xrEndFrame
+    XrResult XRAPI_CALL xrEndFrame(XrSession session, const XrFrameEndInfo* frameEndInfo) {
+        configureFrameThread();
 
-                    // Output the edited list if needed.
-                    if (properties) {
-                        memcpy(
-                            properties, propertiesArray.data(), propertiesArray.size() * sizeof(XrExtensionProperties));
-                    }
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+
+        float scale = 1.f;
+        float displayRefreshRate = 0;
+        bool isAsync = false;
+        {
+            std::unique_lock lock(framesMutex);
+            isAsync = asyncEndFrameSessions.count(session);
+            if (frameWaitCounter) {
+                lastFrameTime = (now.QuadPart - frameWaitCounter) * 1'000'000'000 / performanceCounterFrequency;
 
-                    // Always return the adjusted count.
-                    *propertyCountOutput = (uint32_t)propertiesArray.size();
-                    if (propertyCapacityInput && propertyCapacityInput < *propertyCountOutput) {
-                        result = XR_ERROR_SIZE_INSUFFICIENT;
+                const auto selection = refreshRateSelections.find(session);
+                if (selection != refreshRateSelections.end() &&
+                    ++selection->second.frameCount > RefreshRateWarmupFrames) {
+                    selection->second.frameTimeSum += lastFrameTime;
+                    if (selection->second.frameCount == RefreshRateWarmupFrames + RefreshRateSelectionFrames) {
+                        const XrDuration averageFrameTime = selection->second.frameTimeSum / RefreshRateSelectionFrames;
+                        Log("Average frame time is %.3f ms\n", averageFrameTime / 1e6);
+                        displayRefreshRate = pickDisplayRefreshRate(selection->second.refreshRates, averageFrameTime);
+                        refreshRateSelections.erase(selection);
                     }
                 }
             }
+            if (implementedExtensions.dynamicResolution && frameEndInfo) {
+                for (const auto& [displayTime, frameScale] : frameScales) {
+                    if (displayTime == frameEndInfo->displayTime) {
+                        scale = frameScale;
+                        break;
+                    }
+                }
+            }
+        }
+
+        if (displayRefreshRate > 0) {
+            requestDisplayRefreshRate(session, displayRefreshRate);
+        }
+
+        // The result of a previous frame, since we returned before the runtime did.
+        XrResult deferredResult = XR_SUCCESS;
+        if (isAsync && frameEndInfo && frameEndInfo->type == XR_TYPE_FRAME_END_INFO) {
+            deferredResult = frameSubmissionThread.takeResult();
+            if (XR_FAILED(deferredResult)) {
+                return deferredResult;
+            }
+
+            frameSubmissionThread.start(
+                [](XrSession session, const XrFrameEndInfo* frameEndInfo) {
+                    return next_xrEndFrame(session, frameEndInfo);
+                },
+                configureFrameThread);
+            FrameSubmissionThread::Submission& submission = frameSubmissionThread.acquire();
+            submission.arena.reset();
+            const XrFrameEndInfo* const copy = copyFrameEndInfo(submission.arena, *frameEndInfo);
+            if (copy) {
+                submission.session = session;
+                submission.frameEndInfo = scale < 1.f ? scaleProjectionLayers(submission.arena, *copy, scale) : copy;
+                frameSubmissionThread.queue(submission);
+                asyncEndFrameCount++;
+                return deferredResult;
+            }
+
+            // We do not know how to copy everything in this frame: submit it ourselves, after the frames in flight.
+            frameSubmissionThread.drain();
+            syncEndFrameCount++;
+        }
+
+        XrResult result;
+        if (scale < 1.f && frameEndInfo->type == XR_TYPE_FRAME_END_INFO) {
+            // The copies only live until the runtime returns.
+            static thread_local Arena arena;
+            arena.reset();
+            result = next_xrEndFrame(session, scaleProjectionLayers(arena, *frameEndInfo, scale));
         } else {
-            result = next_xrEnumerateInstanceExtensionProperties(
-                layerName, propertyCapacityInput, propertyCountOutput, properties);
+            result = next_xrEndFrame(session, frameEndInfo);
+        }
+
+        return result == XR_SUCCESS ? deferredResult : result;
+    }
+
+    // Our implementation of xrGetVisibilityMaskKHR() when the runtime does not implement XR_KHR_visibility_mask.
+    XrResult XRAPI_CALL synthesizedGetVisibilityMaskKHR(XrSession session,
+                                                        XrViewConfigurationType viewConfigurationType,
+                                                        uint32_t viewIndex,
+                                                        XrVisibilityMaskTypeKHR visibilityMaskType,
+                                                        XrVisibilityMaskKHR* visibilityMask) {
+        if (!visibilityMask || visibilityMask->type != XR_TYPE_VISIBILITY_MASK_KHR ||
+            visibilityMaskType < XR_VISIBILITY_MASK_TYPE_HIDDEN_TRIANGLE_MESH_KHR ||
+            visibilityMaskType > XR_VISIBILITY_MASK_TYPE_LINE_LOOP_KHR) {
+            return XR_ERROR_VALIDATION_FAILURE;
+        }
+
+        std::unique_lock lock(visibilityMasksMutex);
+        const SynthesizedVisibilityMaskKey key{session, viewConfigurationType, viewIndex};
+        const auto it = synthesizedVisibilityMasks.try_emplace(key, SynthesizedVisibilityMask{{}, false}).first;
+        if (!it->second.isFovKnown) {
+            // We do not know the field of view until the application locates the views. An empty mask is valid, and
+            // we will signal a change when we learn the field of view.
+            return writeVisibilityMask(VisibilityMask{}, visibilityMask);
+        }
+
+        auto cached = it->second.masks.find(visibilityMaskType);
+        if (cached == it->second.masks.end()) {
+            VisibilityMask mask;
+            makeVisibilityMask(it->second.fov, visibilityMaskType, mask.vertices, mask.indices);
+            cached = it->second.masks.insert_or_assign(visibilityMaskType, std::move(mask)).first;
+        }
+        return writeVisibilityMask(cached->second, visibilityMask);
+    }
+
+#ifdef XR_USE_GRAPHICS_API_VULKAN
+    // Remove the duplicate and masked entries from a space-separated list of Vulkan extensions.
+    std::string filterVulkanExtensions(std::string_view extensions) {
+        std::vector<std::string_view> kept;
+        while (!extensions.empty()) {
+            const size_t offset = extensions.find(' ');
+            const std::string_view extension = extensions.substr(0, offset);
+            extensions = offset != std::string_view::npos ? extensions.substr(offset + 1) : std::string_view();
+
+            if (extension.empty() || std::find(kept.cbegin(), kept.cend(), extension) != kept.cend()) {
+                continue;
+            }
+            if (std::find(vulkanExtensionsToMask.cbegin(), vulkanExtensionsToMask.cend(), extension) !=
+                vulkanExtensionsToMask.cend()) {
+                Log("Masking Vulkan extension %.*s\n", (int)extension.size(), extension.data());
+                continue;
+            }
+            kept.push_back(extension);
+        }
+
+        std::string result;
+        for (const std::string_view& extension : kept) {
+            if (!result.empty()) {
+                result += ' ';
+            }
+            result += extension;
+        }
+        return result;
+    }
+
+    // Common implementation of xrGetVulkanInstanceExtensionsKHR() and xrGetVulkanDeviceExtensionsKHR(). The list is
+    // queried from the runtime and filtered only once per system, and then served with the two-call idiom.
+    XrResult getVulkanExtensions(NextFunction<PFN_xrGetVulkanInstanceExtensionsKHR>& next,
+                                 std::map<XrSystemId, std::string> InstanceCache::*cache,
+                                 XrInstance instance,
+                                 XrSystemId systemId,
+                                 uint32_t bufferCapacityInput,
+                                 uint32_t* bufferCountOutput,
+                                 char* buffer) {
+        if (!bufferCountOutput || (bufferCapacityInput && !buffer)) {
+            return next(instance, systemId, bufferCapacityInput, bufferCountOutput, buffer);
+        }
+
+        std::string extensions;
+        bool isCached = false;
+        {
+            std::shared_lock lock(instanceCachesMutex);
+            const auto it = instanceCaches.find(instance);
+            if (it != instanceCaches.cend()) {
+                const auto cached = (it->second.*cache).find(systemId);
+                if (cached != (it->second.*cache).cend()) {
+                    extensions = cached->second;
+                    isCached = true;
+                }
+            }
+        }
+
+        if (!isCached) {
+            uint32_t count = 0;
+            XrResult result = next(instance, systemId, 0, &count, nullptr);
+            if (XR_FAILED(result)) {
+                return result;
+            }
+            std::vector<char> runtimeExtensions(count);
+            result = next(instance, systemId, count, &count, runtimeExtensions.data());
+            if (XR_FAILED(result)) {
+                return result;
+            }
+
+            extensions = filterVulkanExtensions(
+                std::string_view(runtimeExtensions.data(), strnlen(runtimeExtensions.data(), count)));
+
+            std::unique_lock lock(instanceCachesMutex);
+            (instanceCaches[instance].*cache).insert_or_assign(systemId, extensions);
+        }
+
+        // Include the terminator.
+        *bufferCountOutput = (uint32_t)extensions.size() + 1;
+        if (bufferCapacityInput) {
+            if (bufferCapacityInput < *bufferCountOutput) {
+                return XR_ERROR_SIZE_INSUFFICIENT;
+            }
+            memcpy(buffer, extensions.c_str(), *bufferCountOutput);
+        }
+
+        return XR_SUCCESS;
+    }
+
+    // https://www.khronos.org/registry/OpenXR/specs/1.0/html/xrspec.html#xrGetVulkanInstanceExtensionsKHR
+    XrResult XRAPI_CALL xrGetVulkanInstanceExtensionsKHR(XrInstance instance,
+                                                         XrSystemId systemId,
+                                                         uint32_t bufferCapacityInput,
+                                                         uint32_t* bufferCountOutput,
+                                                         char* buffer) {
+        return getVulkanExtensions(next_xrGetVulkanInstanceExtensionsKHR,
+                                   &InstanceCache::vulkanInstanceExtensions,
+                                   instance,
+                                   systemId,
+                                   bufferCapacityInput,
+                                   bufferCountOutput,
+                                   buffer);
+    }
+
+    // https://www.khronos.org/registry/OpenXR/specs/1.0/html/xrspec.html#xrGetVulkanDeviceExtensionsKHR
+    XrResult XRAPI_CALL xrGetVulkanDeviceExtensionsKHR(XrInstance instance,
+                                                       XrSystemId systemId,
+                                                       uint32_t bufferCapacityInput,
+                                                       uint32_t* bufferCountOutput,
+                                                       char* buffer) {
+        return getVulkanExtensions(next_xrGetVulkanDeviceExtensionsKHR,
+                                   &InstanceCache::vulkanDeviceExtensions,
+                                   instance,
+                                   systemId,
+                                   bufferCapacityInput,
+                                   bufferCountOutput,
+                                   buffer);
+    }
+
+    // Copy a list of Vulkan extension or layer names into the arena, without the masked ones.
+    template <typename Container>
+    const char* const* filterVulkanNames(Arena& arena,
+                                         const char* const* names,
+                                         uint32_t count,
+                                         const Container& namesToMask,
+                                         const char* kind,
+                                         uint32_t& filteredCount) {
+        const char** const filteredNames = arena.copyArray(const_cast<const char**>(names), count);
+        filteredCount = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            if (std::find(namesToMask.cbegin(), namesToMask.cend(), names[i]) != namesToMask.cend()) {
+                Log("Removing Vulkan %s %s\n", kind, names[i]);
+                continue;
+            }
+            filteredNames[filteredCount++] = names[i];
+        }
+        return filteredNames;
+    }
+
+    // https://www.khronos.org/registry/OpenXR/specs/1.0/html/xrspec.html#xrCreateVulkanInstanceKHR
+    XrResult XRAPI_CALL xrCreateVulkanInstanceKHR(XrInstance instance,
+                                                  const XrVulkanInstanceCreateInfoKHR* createInfo,
+                                                  VkInstance* vulkanInstance,
+                                                  VkResult* vulkanResult) {
+        if (!createInfo || createInfo->type != XR_TYPE_VULKAN_INSTANCE_CREATE_INFO_KHR ||
+            !createInfo->vulkanCreateInfo) {
+            return next_xrCreateVulkanInstanceKHR(instance, createInfo, vulkanInstance, vulkanResult);
+        }
+
+        Arena arena;
+        VkInstanceCreateInfo* const vulkanCreateInfo = arena.copy(*createInfo->vulkanCreateInfo);
+        vulkanCreateInfo->ppEnabledExtensionNames = filterVulkanNames(arena,
+                                                                      vulkanCreateInfo->ppEnabledExtensionNames,
+                                                                      vulkanCreateInfo->enabledExtensionCount,
+                                                                      vulkanExtensionsToMask,
+                                                                      "extension",
+                                                                      vulkanCreateInfo->enabledExtensionCount);
+        vulkanCreateInfo->ppEnabledLayerNames = filterVulkanNames(arena,
+                                                                  vulkanCreateInfo->ppEnabledLayerNames,
+                                                                  vulkanCreateInfo->enabledLayerCount,
+                                                                  vulkanLayersToMask,
+                                                                  "layer",
+                                                                  vulkanCreateInfo->enabledLayerCount);
+        XrVulkanInstanceCreateInfoKHR* const chainCreateInfo = arena.copy(*createInfo);
+        chainCreateInfo->vulkanCreateInfo = vulkanCreateInfo;
+
+        return next_xrCreateVulkanInstanceKHR(instance, chainCreateInfo, vulkanInstance, vulkanResult);
+    }
+
+    // https://www.khronos.org/registry/OpenXR/specs/1.0/html/xrspec.html#xrCreateVulkanDeviceKHR
+    XrResult XRAPI_CALL xrCreateVulkanDeviceKHR(XrInstance instance,
+                                                const XrVulkanDeviceCreateInfoKHR* createInfo,
+                                                VkDevice* vulkanDevice,
+                                                VkResult* vulkanResult) {
+        if (!createInfo || createInfo->type != XR_TYPE_VULKAN_DEVICE_CREATE_INFO_KHR ||
+            !createInfo->vulkanCreateInfo) {
+            return next_xrCreateVulkanDeviceKHR(instance, createInfo, vulkanDevice, vulkanResult);
+        }
+
+        // Device layers are deprecated in Vulkan, but we strip them too for consistency.
+        Arena arena;
+        VkDeviceCreateInfo* const vulkanCreateInfo = arena.copy(*createInfo->vulkanCreateInfo);
+        vulkanCreateInfo->ppEnabledExtensionNames = filterVulkanNames(arena,
+                                                                      vulkanCreateInfo->ppEnabledExtensionNames,
+                                                                      vulkanCreateInfo->enabledExtensionCount,
+                                                                      vulkanExtensionsToMask,
+                                                                      "extension",
+                                                                      vulkanCreateInfo->enabledExtensionCount);
+        vulkanCreateInfo->ppEnabledLayerNames = filterVulkanNames(arena,
+                                                                  vulkanCreateInfo->ppEnabledLayerNames,
+                                                                  vulkanCreateInfo->enabledLayerCount,
+                                                                  vulkanLayersToMask,
+                                                                  "layer",
+                                                                  vulkanCreateInfo->enabledLayerCount);
+        XrVulkanDeviceCreateInfoKHR* const chainCreateInfo = arena.copy(*createInfo);
+        chainCreateInfo->vulkanCreateInfo = vulkanCreateInfo;
+
+        return next_xrCreateVulkanDeviceKHR(instance, chainCreateInfo, vulkanDevice, vulkanResult);
+    }
+#endif
+
+    // Check a conversion done by the runtime against our mapping, and move the origin of the mapping to it. The mapping
+    // is (re)calibrated with a second conversion one second later when it is missing or has drifted.
+    void validatePerformanceCounterMapping(XrInstance instance, int64_t performanceCounter, XrTime time) {
+        std::unique_lock lock(timeCalibrationMutex);
+        if (timeCalibrationFailed) {
+            return;
+        }
+
+        ClockMapping::Parameters parameters;
+        if (performanceCounterMapping.load(parameters)) {
+            const int64_t drift = ClockMapping::forward(parameters, performanceCounter) - time;
+            if (std::abs(drift) <= TimeConversionTolerance) {
+                parameters.sourceOrigin = performanceCounter;
+                parameters.targetOrigin = time;
+                performanceCounterMapping.store(parameters);
+                return;
+            }
+            Log("Performance counter conversion drifted by %lld ns\n", (long long)drift);
+        }
+
+        LARGE_INTEGER performanceCounter1;
+        performanceCounter1.QuadPart = performanceCounter + performanceCounterFrequency;
+        XrTime time1;
+        if (XR_FAILED(next_xrConvertWin32PerformanceCounterToTimeKHR(instance, &performanceCounter1, &time1)) ||
+            !ClockMapping::fromSamples(performanceCounter, time, performanceCounter1.QuadPart, time1, parameters)) {
+            // Leave all conversions to the runtime.
+            Log("Failed to calibrate performance counter conversion\n");
+            performanceCounterMapping.clear();
+            timeCalibrationFailed = true;
+            return;
+        }
+        performanceCounterMapping.store(parameters);
+        timeCalibrationCount++;
+    }
+
+    // https://www.khronos.org/registry/OpenXR/specs/1.0/html/xrspec.html#xrConvertWin32PerformanceCounterToTimeKHR
+    XrResult XRAPI_CALL xrConvertWin32PerformanceCounterToTimeKHR(XrInstance instance,
+                                                                   const LARGE_INTEGER* performanceCounter,
+                                                                   XrTime* time) {
+        // Anything unusual (including errors) is left to the runtime.
+        const bool isLocal = localTimeConversion && instance == currentInstance.load(std::memory_order_relaxed) &&
+                             performanceCounter && performanceCounter->QuadPart > 0 && time;
+        if (isLocal) {
+            ClockMapping::Parameters parameters;
+            if (performanceCounterMapping.load(parameters) &&
+                std::abs(performanceCounter->QuadPart - parameters.sourceOrigin) < performanceCounterFrequency) {
+                const XrTime localTime = ClockMapping::forward(parameters, performanceCounter->QuadPart);
+                if (localTime > 0) {
+                    *time = localTime;
+                    localTimeConversionCount.fetch_add(1, std::memory_order_relaxed);
+                    return XR_SUCCESS;
+                }
+            }
+        }
+
+        const XrResult result = next_xrConvertWin32PerformanceCounterToTimeKHR(instance, performanceCounter, time);
+        runtimeTimeConversionCount.fetch_add(1, std::memory_order_relaxed);
+        if (isLocal && XR_SUCCEEDED(result)) {
+            validatePerformanceCounterMapping(instance, performanceCounter->QuadPart, *time);
+        }
+
+        return result;
+    }
+
+    // https://www.khronos.org/registry/OpenXR/specs/1.0/html/xrspec.html#xrConvertTimeToWin32PerformanceCounterKHR
+    XrResult XRAPI_CALL xrConvertTimeToWin32PerformanceCounterKHR(XrInstance instance,
+                                                                   XrTime time,
+                                                                   LARGE_INTEGER* performanceCounter) {
+        const bool isLocal = localTimeConversion && instance == currentInstance.load(std::memory_order_relaxed) &&
+                             time > 0 && performanceCounter;
+        if (isLocal) {
+            ClockMapping::Parameters parameters;
+            if (performanceCounterMapping.load(parameters)) {
+                const int64_t localPerformanceCounter = ClockMapping::inverse(parameters, time);
+                if (localPerformanceCounter > 0 &&
+                    std::abs(localPerformanceCounter - parameters.sourceOrigin) < performanceCounterFrequency) {
+                    performanceCounter->QuadPart = localPerformanceCounter;
+                    localTimeConversionCount.fetch_add(1, std::memory_order_relaxed);
+                    return XR_SUCCESS;
+                }
+            }
+        }
+
+        const XrResult result = next_xrConvertTimeToWin32PerformanceCounterKHR(instance, time, performanceCounter);
+        runtimeTimeConversionCount.fetch_add(1, std::memory_order_relaxed);
+        if (isLocal && XR_SUCCEEDED(result)) {
+            // The inverse conversion is rounded to whole ticks, so validate with an exact sample in the forward
+            // direction instead.
+            LARGE_INTEGER sampleCounter = *performanceCounter;
+            XrTime sampleTime;
+            if (XR_SUCCEEDED(next_xrConvertWin32PerformanceCounterToTimeKHR(instance, &sampleCounter, &sampleTime))) {
+                validatePerformanceCounterMapping(instance, sampleCounter.QuadPart, sampleTime);
+            }
         }
 
         return result;
     }
 
+    // A stub that does nothing and succeeds, for functions whose outputs are optional.
+    template <typename PFN>
+    struct NoOpStub;
+    template <typename... Args>
+    struct NoOpStub<XrResult(XRAPI_PTR*)(Args...)> {
+        static XrResult XRAPI_CALL invoke(Args...) {
+            return XR_SUCCESS;
+        }
+    };
+
+    // A stub that reports an empty visibility mask, so that the application renders the full view.
+    XrResult XRAPI_CALL emptyVisibilityMaskStub(XrSession session,
+                                                XrViewConfigurationType viewConfigurationType,
+                                                uint32_t viewIndex,
+                                                XrVisibilityMaskTypeKHR visibilityMaskType,
+                                                XrVisibilityMaskKHR* visibilityMask) {
+        if (!visibilityMask || visibilityMask->type != XR_TYPE_VISIBILITY_MASK_KHR) {
+            return XR_ERROR_VALIDATION_FAILURE;
+        }
+        visibilityMask->vertexCountOutput = 0;
+        visibilityMask->indexCountOutput = 0;
+        return XR_SUCCESS;
+    }
+
+    // The functions that can be replaced with a stub, and their stub.
+#define FUNCTION_STUBS(_)                                                                                              \
+    _(xrGetVisibilityMaskKHR, emptyVisibilityMaskStub)                                                                 \
+    _(xrPerfSettingsSetPerformanceLevelEXT, NoOpStub<PFN_xrPerfSettingsSetPerformanceLevelEXT>::invoke)                \
+    _(xrSetDebugUtilsObjectNameEXT, NoOpStub<PFN_xrSetDebugUtilsObjectNameEXT>::invoke)                                \
+    _(xrSubmitDebugUtilsMessageEXT, NoOpStub<PFN_xrSubmitDebugUtilsMessageEXT>::invoke)                                \
+    _(xrSessionBeginDebugUtilsLabelRegionEXT, NoOpStub<PFN_xrSessionBeginDebugUtilsLabelRegionEXT>::invoke)            \
+    _(xrSessionEndDebugUtilsLabelRegionEXT, NoOpStub<PFN_xrSessionEndDebugUtilsLabelRegionEXT>::invoke)                \
+    _(xrSessionInsertDebugUtilsLabelEXT, NoOpStub<PFN_xrSessionInsertDebugUtilsLabelEXT>::invoke)
+
+    struct FunctionStub {
+        uint64_t nameHash;
+        PFN_xrVoidFunction stub;
+    };
+#define FUNCTION_STUB(name, stub) FunctionStub{hashName(#name), reinterpret_cast<PFN_xrVoidFunction>(stub)},
+    const FunctionStub functionStubs[] = {FUNCTION_STUBS(FUNCTION_STUB)};
+#undef FUNCTION_STUB
+
+    constexpr bool hasFunctionStub(uint64_t nameHash) {
+#define FUNCTION_STUB_NAME(name, stub) hashName(#name),
+        for (const uint64_t candidate : {FUNCTION_STUBS(FUNCTION_STUB_NAME)}) {
+            if (candidate == nameHash) {
+                return true;
+            }
+        }
+#undef FUNCTION_STUB_NAME
+        return false;
+    }
+#undef FUNCTION_STUBS
+
+#ifdef WRAPPER_BAKED_CONFIG
+    // The text configuration ignores a stubFunction without a stub, so a baked one must not mask the function instead.
+    constexpr bool hasBakedStubs() {
+        for (const FunctionOverride& functionOverride : baked::FunctionOverrides) {
+            if (functionOverride.isStub && !hasFunctionStub(functionOverride.nameHash)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    static_assert(hasBakedStubs(), "The baked configuration stubs a function that has no stub");
+#endif
+
+    PFN_xrVoidFunction findFunctionStub(uint64_t nameHash) {
+        for (const FunctionStub& functionStub : functionStubs) {
+            if (functionStub.nameHash == nameHash) {
+                return functionStub.stub;
+            }
+        }
+        return nullptr;
+    }
+
+    const FunctionOverride* findFunctionOverride(uint64_t nameHash) {
+        for (const FunctionOverride& functionOverride : functionOverrides) {
+            if (functionOverride.nameHash == nameHash) {
+                return &functionOverride;
+            }
+        }
+        return nullptr;
+    }
+
     // Our proxy implementation of xrGetInstanceProcAddr() to override any function.
     XrResult XRAPI_CALL xrGetInstanceProcAddr(XrInstance instance, const char* name, PFN_xrVoidFunction* function) {
-        const XrResult result = next_xrGetInstanceProcAddr(instance, name, function);
+        // All the lookups below are done with the hash of the function name.
+        const uint64_t nameHash = hashName(name);
 
-        if (XR_SUCCEEDED(result)) {
-            const std::string_view functionName = name;
-            if (functionName == "xrEnumerateInstanceExtensionProperties") {
+        const FunctionOverride* const functionOverride = findFunctionOverride(nameHash);
+        const PFN_xrVoidFunction stub =
+            functionOverride && functionOverride->isStub ? findFunctionStub(nameHash) : nullptr;
+        if (functionOverride && !stub) {
+            *function = nullptr;
+            return XR_ERROR_FUNCTION_UNSUPPORTED;
+        }
+
+        if (stub) {
+            // Only replace functions that the runtime implements.
+            const XrResult result = resolveInstanceFunction(instance, nameHash, name, function);
+            if (XR_SUCCEEDED(result)) {
+                *function = stub;
+            }
+            return result;
+        }
+
+        switch (nameHash) {
+        case hashName("xrEnumerateInstanceExtensionProperties"): {
+            const XrResult result = next_xrGetInstanceProcAddr(instance, name, function);
+            if (XR_SUCCEEDED(result)) {
                 // Remember where the real xrEnumerateInstanceExtensionProperties() is.
                 next_xrEnumerateInstanceExtensionProperties =
                     reinterpret_cast<PFN_xrEnumerateInstanceExtensionProperties>(*function);
 
                 // Tell the loader to use our own implementation of xrEnumerateInstanceExtensionProperties().
                 *function = reinterpret_cast<PFN_xrVoidFunction>(xrEnumerateInstanceExtensionProperties);
+            }
+            return result;
+        }
+
+        case hashName("xrCreateInstance"): {
+            const XrResult result = next_xrGetInstanceProcAddr(instance, name, function);
+            if (XR_SUCCEEDED(result)) {
+                next_xrCreateInstance = reinterpret_cast<PFN_xrCreateInstance>(*function);
+                *function = reinterpret_cast<PFN_xrVoidFunction>(xrCreateInstance);
+            }
+            return result;
+        }
+
+        case hashName("xrDestroyInstance"):
+            return installHook(
+                instance, next_xrDestroyInstance, reinterpret_cast<PFN_xrVoidFunction>(xrDestroyInstance), function);
+
+        case hashName("xrGetInstanceProperties"):
+            return installHook(instance,
+                               next_xrGetInstanceProperties,
+                               reinterpret_cast<PFN_xrVoidFunction>(xrGetInstanceProperties),
+                               function);
+
+        case hashName("xrGetSystemProperties"):
+            return installHook(instance,
+                               next_xrGetSystemProperties,
+                               reinterpret_cast<PFN_xrVoidFunction>(xrGetSystemProperties),
+                               function);
+
+        case hashName("xrPollEvent"):
+            return installHook(
+                instance, next_xrPollEvent, reinterpret_cast<PFN_xrVoidFunction>(xrPollEvent), function);
+
+        case hashName("xrDestroySession"):
+            return installHook(
+                instance, next_xrDestroySession, reinterpret_cast<PFN_xrVoidFunction>(xrDestroySession), function);
+
+        case hashName("xrLocateViews"):
+            return installHook(
+                instance, next_xrLocateViews, reinterpret_cast<PFN_xrVoidFunction>(xrLocateViews), function);
+
+        case hashName("xrCreateReferenceSpace"):
+            return installHook(instance,
+                               next_xrCreateReferenceSpace,
+                               reinterpret_cast<PFN_xrVoidFunction>(xrCreateReferenceSpace),
+                               function);
+
+        case hashName("xrCreateActionSpace"):
+            return installHook(instance,
+                               next_xrCreateActionSpace,
+                               reinterpret_cast<PFN_xrVoidFunction>(xrCreateActionSpace),
+                               function);
+
+        case hashName("xrDestroySpace"):
+            return installHook(
+                instance, next_xrDestroySpace, reinterpret_cast<PFN_xrVoidFunction>(xrDestroySpace), function);
+
+        case hashName("xrLocateHandJointsEXT"):
+            return installHook(instance,
+                               next_xrLocateHandJointsEXT,
+                               reinterpret_cast<PFN_xrVoidFunction>(xrLocateHandJointsEXT),
+                               function);
+
+        case hashName("xrDestroyHandTrackerEXT"):
+            return installHook(instance,
+                               next_xrDestroyHandTrackerEXT,
+                               reinterpret_cast<PFN_xrVoidFunction>(xrDestroyHandTrackerEXT),
+                               function);
+
+        case hashName("xrCreateSession"):
+            return installHook(
+                instance, next_xrCreateSession, reinterpret_cast<PFN_xrVoidFunction>(xrCreateSession), function);
+
+        case hashName("xrEnumerateDisplayRefreshRatesFB"):
+        case hashName("xrGetDisplayRefreshRateFB"):
+        case hashName("xrRequestDisplayRefreshRateFB"):
+            // We enabled the extension without the application knowing.
+            if (instance == currentInstance.load() && isDisplayRefreshRateHidden) {
+                *function = nullptr;
+                return XR_ERROR_FUNCTION_UNSUPPORTED;
+            }
+            break;
+
+        case hashName("xrPerfSettingsSetPerformanceLevelEXT"):
+            // We enabled the extension without the application knowing.
+            if (instance == currentInstance.load() && isPerformanceSettingsHidden) {
+                *function = nullptr;
+                return XR_ERROR_FUNCTION_UNSUPPORTED;
+            }
+            break;
+
+        case hashName("xrEndSession"):
+            return installHook(
+                instance, next_xrEndSession, reinterpret_cast<PFN_xrVoidFunction>(xrEndSession), function);
+
+        case hashName("xrBeginSession"):
+            return installHook(
+                instance, next_xrBeginSession, reinterpret_cast<PFN_xrVoidFunction>(xrBeginSession), function);
+
+        case hashName("xrWaitFrame"):
+            return installHook(
+                instance, next_xrWaitFrame, reinterpret_cast<PFN_xrVoidFunction>(xrWaitFrame), function);
+
+        case hashName("xrBeginFrame"):
+            return installHook(
+                instance, next_xrBeginFrame, reinterpret_cast<PFN_xrVoidFunction>(xrBeginFrame), function);
+
+        case hashName("xrEndFrame"):
+            return installHook(
+                instance, next_xrEndFrame, reinterpret_cast<PFN_xrVoidFunction>(xrEndFrame), function);
+
+        case hashName("xrLocateSpace"):
+            if (!isCallDiagnosticEnabled()) {
+                break;
+            }
+            return installHook(
+                instance, next_xrLocateSpace, reinterpret_cast<PFN_xrVoidFunction>(xrLocateSpace), function);
+
+        case hashName("xrAcquireSwapchainImage"):
+            if (!isCallDiagnosticEnabled()) {
+                break;
+            }
+            return installHook(instance,
+                               next_xrAcquireSwapchainImage,
+                               reinterpret_cast<PFN_xrVoidFunction>(xrAcquireSwapchainImage),
+                               function);
+
+        case hashName("xrWaitSwapchainImage"):
+            if (!isCallDiagnosticEnabled()) {
+                break;
+            }
+            return installHook(instance,
+                               next_xrWaitSwapchainImage,
+                               reinterpret_cast<PFN_xrVoidFunction>(xrWaitSwapchainImage),
+                               function);
+
+        case hashName("xrReleaseSwapchainImage"):
+            if (!isCallDiagnosticEnabled()) {
+                break;
+            }
+            return installHook(instance,
+                               next_xrReleaseSwapchainImage,
+                               reinterpret_cast<PFN_xrVoidFunction>(xrReleaseSwapchainImage),
+                               function);
+
+        case hashName("xrGetVisibilityMaskKHR"):
+            if (instance == currentInstance.load() && implementedExtensions.visibilityMask) {
+                *function = reinterpret_cast<PFN_xrVoidFunction>(synthesizedGetVisibilityMaskKHR);
                 return XR_SUCCESS;
             }
+            return installHook(instance,
+                               next_xrGetVisibilityMaskKHR,
+                               reinterpret_cast<PFN_xrVoidFunction>(xrGetVisibilityMaskKHR),
+                               function);
+
+#ifdef XR_USE_GRAPHICS_API_VULKAN
+        case hashName("xrGetVulkanInstanceExtensionsKHR"):
+            return installHook(instance,
+                               next_xrGetVulkanInstanceExtensionsKHR,
+                               reinterpret_cast<PFN_xrVoidFunction>(xrGetVulkanInstanceExtensionsKHR),
+                               function);
+
+        case hashName("xrGetVulkanDeviceExtensionsKHR"):
+            return installHook(instance,
+                               next_xrGetVulkanDeviceExtensionsKHR,
+                               reinterpret_cast<PFN_xrVoidFunction>(xrGetVulkanDeviceExtensionsKHR),
+                               function);
+
+        case hashName("xrCreateVulkanInstanceKHR"):
+            return installHook(instance,
+                               next_xrCreateVulkanInstanceKHR,
+                               reinterpret_cast<PFN_xrVoidFunction>(xrCreateVulkanInstanceKHR),
+                               function);
+
+        case hashName("xrCreateVulkanDeviceKHR"):
+            return installHook(instance,
+                               next_xrCreateVulkanDeviceKHR,
+                               reinterpret_cast<PFN_xrVoidFunction>(xrCreateVulkanDeviceKHR),
+                               function);
+#endif
+
+        case hashName("xrConvertWin32PerformanceCounterToTimeKHR"):
+            return installHook(instance,
+                               next_xrConvertWin32PerformanceCounterToTimeKHR,
+                               reinterpret_cast<PFN_xrVoidFunction>(xrConvertWin32PerformanceCounterToTimeKHR),
+                               function);
+
+        case hashName("xrConvertTimeToWin32PerformanceCounterKHR"):
+            return installHook(instance,
+                               next_xrConvertTimeToWin32PerformanceCounterKHR,
+                               reinterpret_cast<PFN_xrVoidFunction>(xrConvertTimeToWin32PerformanceCounterKHR),
+                               function);
         }
 
-        return result;
+        // Answer from our own table when possible, rather than going through the runtime's lookup.
+        return resolveInstanceFunction(instance, nameHash, name, function);
+    }
+
+#ifndef WRAPPER_BAKED_CONFIG
+    // Apply a performance profile option, from the [runtime] section or from an [app:<name>] section.
+    // Returns false if the option is not recognized.
+    bool applyPerformanceOption(PerformanceProfile& profile, std::string_view name, std::string_view value) {
+        if (name == "displayRefreshRate") {
+            profile.displayRefreshRate = value == "auto" ? 0.f : std::max(0.f, std::stof(std::string(value)));
+            return true;
+        }
+
+        std::optional<XrPerfSettingsLevelEXT>* level = nullptr;
+        if (name == "cpuPerformanceLevel") {
+            level = &profile.cpuLevel;
+        } else if (name == "gpuPerformanceLevel") {
+            level = &profile.gpuLevel;
+        } else {
+            return false;
+        }
+
+        for (const XrPerfSettingsLevelEXT candidate : {XR_PERF_SETTINGS_LEVEL_POWER_SAVINGS_EXT,
+                                                       XR_PERF_SETTINGS_LEVEL_SUSTAINED_LOW_EXT,
+                                                       XR_PERF_SETTINGS_LEVEL_SUSTAINED_HIGH_EXT,
+                                                       XR_PERF_SETTINGS_LEVEL_BOOST_EXT}) {
+            if (value == getPerformanceLevelName(candidate)) {
+                *level = candidate;
+                return true;
+            }
+        }
+        Log("Unrecognized performance level `%.*s'\n", (int)value.size(), value.data());
+        return true;
+    }
+
+    // Apply an option that does not depend on where the configuration comes from.
+    // Returns false if the option is not recognized.
+    bool applyOption(std::string_view name, std::string_view value) {
+        if (name == "benchmarkMasking") {
+            benchmarkMasking = value == "1" || value == "true";
+        } else if (name == "functionResolution") {
+            lazyResolution = value == "lazy";
+        } else if (name == "benchmarkResolution") {
+            benchmarkResolution = value == "1" || value == "true";
+#ifdef XR_USE_GRAPHICS_API_VULKAN
+        } else if (name == "maskVulkanExtension") {
+            vulkanExtensionsToMask.push_back(std::string(value));
+            Log("Masking Vulkan extension: %.*s\n", (int)value.size(), value.data());
+        } else if (name == "maskVulkanLayer") {
+            vulkanLayersToMask.push_back(std::string(value));
+            Log("Masking Vulkan layer: %.*s\n", (int)value.size(), value.data());
+#endif
+        } else if (name == "flightRecorderSize") {
+            flightRecorderSize = std::min(std::stoul(std::string(value)), 1ul << 16);
+        } else if (name == "flightRecorderArguments") {
+            flightRecorderArguments = (std::min(std::stoul(std::string(value)), 1ul << 12) + 7) & ~7u;
+        } else if (name == "hangWatchdogThreshold") {
+            hangWatchdogThreshold = std::stoul(std::string(value));
+        } else if (name == "slowCallThreshold") {
+            slowCallThreshold = std::stoul(std::string(value));
+        } else if (name == "asyncEndFrame") {
+            asyncEndFrame = value == "1" || value == "true";
+        } else if (name == "asyncEndFrameVulkan") {
+            asyncEndFrameVulkan = value == "1" || value == "true";
+        } else if (name == "frameThreadPriority") {
+            if (value == "normal") {
+                frameThreadPriority = THREAD_PRIORITY_NORMAL;
+            } else if (value == "aboveNormal") {
+                frameThreadPriority = THREAD_PRIORITY_ABOVE_NORMAL;
+            } else if (value == "highest") {
+                frameThreadPriority = THREAD_PRIORITY_HIGHEST;
+            } else if (value == "timeCritical") {
+                frameThreadPriority = THREAD_PRIORITY_TIME_CRITICAL;
+            } else {
+                Log("Unrecognized thread priority `%.*s'\n", (int)value.size(), value.data());
+            }
+        } else if (name == "frameThreadAffinity") {
+            frameThreadAffinity = (DWORD_PTR)std::stoull(std::string(value), nullptr, 0);
+        } else if (name == "frameThreadTask") {
+            frameThreadTaskStorage.assign(value.cbegin(), value.cend());
+            frameThreadTask = frameThreadTaskStorage;
+        } else if (name == "efficientBackgroundThreads") {
+            efficientBackgroundThreads = value == "1" || value == "true";
+        } else if (name == "dynamicResolution") {
+            dynamicResolution = value == "1" || value == "true";
+        } else if (name == "dynamicResolutionMinScale") {
+            dynamicResolutionMinScale = std::clamp(std::stof(std::string(value)), 0.1f, 1.f);
+        } else if (name == "cpuPerformanceLevel" || name == "gpuPerformanceLevel" || name == "displayRefreshRate") {
+            applyPerformanceOption(defaultPerformanceProfile, name, value);
+        } else if (name == "stepDownPerformanceLevel") {
+            stepDownPerformanceLevel = value == "1" || value == "true";
+        } else if (name == "handTrackingRate") {
+            handTrackingRate = std::stod(std::string(value));
+        } else if (name == "shareSpaces") {
+            shareSpaces = value == "1" || value == "true";
+        } else if (name == "synthesizeVisibilityMask") {
+            synthesizeVisibilityMask = value == "1" || value == "true";
+        } else if (name == "cacheVisibilityMasks") {
+            cacheVisibilityMasks = value == "1" || value == "true";
+        } else if (name == "cacheProperties") {
+            cacheProperties = value == "1" || value == "true";
+        } else if (name == "localTimeConversion") {
+            localTimeConversion = value == "1" || value == "true";
+        } else if (name == "maskFunction" || name == "stubFunction") {
+            const bool isStub = name == "stubFunction";
+            const uint64_t nameHash = hashName(value);
+            if (isStub && !hasFunctionStub(nameHash)) {
+                Log("No stub available for function `%.*s'\n", (int)value.size(), value.data());
+            } else {
+                functionOverrides.push_back({nameHash, isStub});
+                Log("%s function: %.*s\n", isStub ? "Stubbing" : "Masking", (int)value.size(), value.data());
+            }
+        } else {
+            return false;
+        }
+        return true;
     }
+#endif
 
     void initializeWrapper() {
         // Create a log file for troubleshooting.
@@ -144,6 +3013,14 @@ namespace {
                 dllHome = std::filesystem::path(path).parent_path();
             }
 
+#ifdef WRAPPER_BAKED_CONFIG
+            // Use the configuration baked into the binary at build time.
+            Log("Using baked configuration\n");
+            openXrRuntime = dllHome / baked::RuntimeLibrary;
+#define APPLY_BAKED_OPTION(variable, value) variable = baked::value;
+            BAKED_OPTIONS(APPLY_BAKED_OPTION)
+#undef APPLY_BAKED_OPTION
+#else
             // Read the configuration.
             std::filesystem::path configPath = dllHome / (std::string(PROJECTNAME) + ".cfg");
             std::ifstream configFile;
@@ -151,20 +3028,84 @@ namespace {
             if (configFile.is_open()) {
                 unsigned int lineNumber = 0;
                 std::string line;
+                std::string layerName;
+                std::string appName;
+                ExtensionRules* rules = &runtimeRules;
                 while (std::getline(configFile, line)) {
                     lineNumber++;
+                    if (line.empty()) {
+                        continue;
+                    }
                     try {
+                        // A [layer:<name>] section holds the rules for the extensions of an API layer, and an
+                        // [app:<name>] section the performance levels of an application. A [runtime] section goes
+                        // back to the runtime's extensions and the global options.
+                        if (!line.empty() && line.front() == '[' && line.back() == ']') {
+                            const std::string section = line.substr(1, line.size() - 2);
+                            if (section == "runtime") {
+                                layerName.clear();
+                                appName.clear();
+                                rules = &runtimeRules;
+                            } else if (section.rfind("layer:", 0) == 0) {
+                                layerName = section.substr(6);
+                                appName.clear();
+                                rules = &layerRules[layerName];
+                            } else if (section.rfind("app:", 0) == 0) {
+                                layerName.clear();
+                                appName = section.substr(4);
+                                rules = &runtimeRules;
+                            } else {
+                                Log("L%u: Unrecognized section `%s'\n", lineNumber, section.c_str());
+                            }
+                            continue;
+                        }
+
                         const auto offset = line.find('=');
                         if (offset != std::string::npos) {
                             const std::string name = line.substr(0, offset);
                             const std::string value = line.substr(offset + 1);
 
-                            if (name == "runtime") {
-                                openXrRuntime = dllHome / (value + ".dll");
+                            if (!appName.empty()) {
+                                if (!applyPerformanceOption(appPerformanceProfiles[appName], name, value)) {
+                                    Log("L%u: Option `%s' is not allowed in an app section\n",
+                                        lineNumber,
+                                        name.c_str());
+                                }
                             } else if (name == "maskExtension") {
-                                extensionsToMask.push_back(value);
-                                Log("Masking extension: %s\n", value.c_str());
-                            } else {
+                                if (value.size() < XR_MAX_EXTENSION_NAME_SIZE) {
+                                    rules->extensionsToMask.push_back(makeExtensionName(value));
+                                    if (layerName.empty()) {
+                                        Log("Masking extension: %s\n", value.c_str());
+                                    } else {
+                                        Log("Masking extension: %s (layer %s)\n", value.c_str(), layerName.c_str());
+                                    }
+                                } else {
+                                    Log("L%u: Extension name is too long `%s'\n", lineNumber, value.c_str());
+                                }
+                            } else if (name == "clampExtensionVersion" || name == "overrideExtensionVersion") {
+                                // The value is <extension>:<version>. This only changes the version that is
+                                // advertised: the application does not tell which version it expects.
+                                const auto separator = value.rfind(':');
+                                if (separator == std::string::npos || separator >= XR_MAX_EXTENSION_NAME_SIZE) {
+                                    Log("L%u: Improperly formatted extension version `%s'\n",
+                                        lineNumber,
+                                        value.c_str());
+                                    continue;
+                                }
+                                ExtensionVersionRule rule;
+                                rule.name = makeExtensionName(value.substr(0, separator));
+                                rule.version = std::stoul(value.substr(separator + 1));
+                                rule.isClamp = name == "clampExtensionVersion";
+                                rules->extensionVersions.push_back(rule);
+                                Log("%s version of extension %s to %u\n",
+                                    rule.isClamp ? "Clamping" : "Overriding",
+                                    rule.name.name,
+                                    rule.version);
+                            } else if (!layerName.empty()) {
+                                Log("L%u: Option `%s' is not allowed in a layer section\n", lineNumber, name.c_str());
+                            } else if (name == "runtime") {
+                                openXrRuntime = dllHome / (value + ".dll");
+                            } else if (!applyOption(name, value)) {
                                 Log("L%u: Unrecognized option `%s'\n", lineNumber, name.c_str());
                             }
                         } else {
@@ -178,8 +3119,28 @@ namespace {
             } else {
                 Log("Failed to open file `%ls'\n", configPath.c_str());
             }
+#endif
+        }
+
+        dynamicResolutionController.reset(dynamicResolutionMinScale);
+
+        if (benchmarkMasking) {
+#ifdef _DEBUG
+            runMaskingBenchmark();
+#else
+            Log("The masking benchmark is only available in Debug builds\n");
+#endif
         }
 
+        LARGE_INTEGER frequency;
+        QueryPerformanceFrequency(&frequency);
+        performanceCounterFrequency = frequency.QuadPart;
+        slowCallThresholdTicks = slowCallThreshold * performanceCounterFrequency / 1000;
+
+#ifdef WRAPPER_API_LAYER
+        // The loader gives us the next layer (or the runtime) at instance creation.
+        Log("Running as API layer `%s'\n", LAYER_NAME);
+#else
         // Load the library for the real OpenXR runtime.
         if (!openXrRuntime.empty()) {
             Log("Loading runtime `%ls'\n", openXrRuntime.c_str());
@@ -191,12 +3152,41 @@ namespace {
                 Log("Failed to load runtime `%ls'\n", openXrRuntime.c_str());
             }
         }
+#endif
     }
 
 } // namespace
 
 // Entry point for the loader.
 extern "C" {
+#ifdef WRAPPER_API_LAYER
+XrResult __declspec(dllexport) XRAPI_CALL
+xrNegotiateLoaderApiLayerInterface(const XrNegotiateLoaderInfo* loaderInfo,
+                                   const char* layerName,
+                                   XrNegotiateApiLayerRequest* apiLayerRequest) {
+    if (!loaderInfo || !layerName || !apiLayerRequest ||
+        loaderInfo->structType != XR_LOADER_INTERFACE_STRUCT_LOADER_INFO ||
+        loaderInfo->structVersion != XR_LOADER_INFO_STRUCT_VERSION ||
+        loaderInfo->structSize != sizeof(XrNegotiateLoaderInfo) ||
+        apiLayerRequest->structType != XR_LOADER_INTERFACE_STRUCT_API_LAYER_REQUEST ||
+        apiLayerRequest->structVersion != XR_API_LAYER_INFO_STRUCT_VERSION ||
+        apiLayerRequest->structSize != sizeof(XrNegotiateApiLayerRequest) ||
+        loaderInfo->minInterfaceVersion > XR_CURRENT_LOADER_API_LAYER_VERSION ||
+        loaderInfo->maxInterfaceVersion < XR_CURRENT_LOADER_API_LAYER_VERSION ||
+        loaderInfo->maxApiVersion < XR_CURRENT_API_VERSION || loaderInfo->minApiVersion > XR_CURRENT_API_VERSION ||
+        std::string_view(layerName) != LAYER_NAME) {
+        return XR_ERROR_INITIALIZATION_FAILED;
+    }
+
+    // Tell the loader to use our own implementations of xrGetInstanceProcAddr() and xrCreateApiLayerInstance().
+    apiLayerRequest->layerInterfaceVersion = XR_CURRENT_LOADER_API_LAYER_VERSION;
+    apiLayerRequest->layerApiVersion = XR_CURRENT_API_VERSION;
+    apiLayerRequest->getInstanceProcAddr = xrGetInstanceProcAddr;
+    apiLayerRequest->createApiLayerInstance = xrCreateApiLayerInstance;
+
+    return XR_SUCCESS;
+}
+#else
 XrResult __declspec(dllexport) XRAPI_CALL xrNegotiateLoaderRuntimeInterface(const XrNegotiateLoaderInfo* loaderInfo,
                                                                             XrNegotiateRuntimeRequest* runtimeRequest) {
     // The loader typically returns XR_ERROR_FILE_ACCESS_ERROR when failing to load any DLL.
@@ -216,18 +3206,30 @@ XrResult __declspec(dllexport) XRAPI_CALL xrNegotiateLoaderRuntimeInterface(cons
 
     return result;
 }
+#endif
 }
 
 BOOL APIENTRY DllMain(HMODULE hModule, DWORD ul_reason_for_call, LPVOID lpReserved) {
     switch (ul_reason_for_call) {
     case DLL_PROCESS_ATTACH:
-        DisableThreadLibraryCalls(hModule);
         initializeWrapper();
+        // The flight recorder (opened at the first instance creation) and the hang watchdog need to know when threads
+        // exit, to give their slot back.
+        if (!flightRecorderSize && !hangWatchdogThreshold) {
+            DisableThreadLibraryCalls(hModule);
+        }
         break;
 
     case DLL_PROCESS_DETACH:
-    case DLL_THREAD_ATTACH:
+        flightRecorder.setCleanExit(true);
+        break;
+
     case DLL_THREAD_DETACH:
+        flightRecorder.releaseThreadRing();
+        callWatchdog.releaseThreadCall();
+        break;
+
+    case DLL_THREAD_ATTACH:
         break;
     }
     return TRUE;
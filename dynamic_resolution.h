@@ -0,0 +1,92 @@
+// MIT License
+//
+// Copyright(c) 2023 Matthieu Bucchianeri
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this softwareand associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+// A closed-loop controller for the resolution scale, fed with the timing of each frame. It backs off quickly when the
+// application misses a frame (the runtime skips a display period) or when the application's own frame time exceeds
+// the budget, and it recovers slowly once there is headroom again.
+class DynamicResolutionController {
+  public:
+    void reset(float minScale) {
+        *this = {};
+        m_minScale = minScale;
+    }
+
+    // Called once per frame with the frame state from xrWaitFrame(), and the time that the application spent on the
+    // previous frame (between xrWaitFrame() and xrEndFrame()).
+    float update(XrTime predictedDisplayTime, XrDuration predictedDisplayPeriod, XrDuration frameTime) {
+        const bool isFrameMissed =
+            m_lastDisplayTime && predictedDisplayTime - m_lastDisplayTime > predictedDisplayPeriod * 3 / 2;
+        m_lastDisplayTime = predictedDisplayTime;
+
+        if (predictedDisplayPeriod > 0 && frameTime > 0) {
+            const float load = (float)frameTime / predictedDisplayPeriod;
+            m_load = m_load > 0 ? m_load + (load - m_load) * LoadSmoothing : load;
+        }
+
+        m_framesSinceChange++;
+        m_framesSinceDecrease++;
+        if ((isFrameMissed || m_load > HighLoad) && m_framesSinceChange >= DecreaseInterval) {
+            m_scale = std::max(m_minScale, m_scale * DecreaseFactor);
+            m_framesSinceChange = m_framesSinceDecrease = 0;
+        } else if (!isFrameMissed && m_load < LowLoad && m_framesSinceDecrease >= IncreaseDelay) {
+            m_scale = std::min(1.f, m_scale + IncreaseStep);
+            m_framesSinceChange = 0;
+        }
+
+        m_scaleSum += m_scale;
+        m_frameCount++;
+        return m_scale;
+    }
+
+    float averageScale() const {
+        return m_frameCount ? (float)(m_scaleSum / m_frameCount) : 1.f;
+    }
+
+    uint32_t frameCount() const {
+        return m_frameCount;
+    }
+
+  private:
+    // The fraction of the display period that the application may use, and the fraction below which we give the
+    // resolution back.
+    static constexpr float HighLoad = 0.9f;
+    static constexpr float LowLoad = 0.7f;
+    static constexpr float LoadSmoothing = 0.1f;
+
+    // Multiplicative decrease, additive increase. Wait a few frames between decreases for the change to be measured,
+    // and longer before increasing again to avoid oscillating around the limit.
+    static constexpr float DecreaseFactor = 0.9f;
+    static constexpr float IncreaseStep = 0.01f;
+    static constexpr uint32_t DecreaseInterval = 10;
+    static constexpr uint32_t IncreaseDelay = 90;
+
+    float m_minScale = 0.5f;
+    float m_scale = 1.f;
+    float m_load = 0.f;
+    XrTime m_lastDisplayTime = 0;
+    uint32_t m_framesSinceChange = 0;
+    uint32_t m_framesSinceDecrease = 0;
+    double m_scaleSum = 0;
+    uint32_t m_frameCount = 0;
+};
@@ -0,0 +1,135 @@
+// MIT License
+//
+// Copyright(c) 2023 Matthieu Bucchianeri
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this softwareand associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#if defined(__AVX2__) || defined(_M_X64) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#endif
+
+// An extension name stored in the same fixed-width form as XrExtensionProperties::extensionName, but zero-padded
+// and aligned so that it can be compared one vector register at a time.
+struct alignas(32) ExtensionName {
+    char name[XR_MAX_EXTENSION_NAME_SIZE];
+};
+
+// Make a zero-padded extension name. Names that do not fit are truncated and will never match.
+inline ExtensionName makeExtensionName(std::string_view name) {
+    ExtensionName result{};
+    memcpy(result.name, name.data(), std::min(name.size(), sizeof(result.name) - 1));
+    return result;
+}
+
+// Reference implementation, used when no vector unit is available.
+inline bool isSameExtensionNameScalar(const char* candidate, const ExtensionName& reference) {
+    return strncmp(candidate, reference.name, XR_MAX_EXTENSION_NAME_SIZE) == 0;
+}
+
+// Compare an extension name reported by the runtime to a zero-padded reference name.
+// The candidate is only guaranteed to be null-terminated: the runtime may leave garbage after the terminator. We
+// therefore only look at the bytes up to (and including) the first null byte in the candidate. Because the reference
+// is zero-padded, a match on the terminator implies that both names end at the same position.
+inline bool isSameExtensionName(const char* candidate, const ExtensionName& reference) {
+#if defined(__AVX2__)
+    static_assert(XR_MAX_EXTENSION_NAME_SIZE % 32 == 0);
+    const __m256i zero = _mm256_setzero_si256();
+    for (size_t i = 0; i < XR_MAX_EXTENSION_NAME_SIZE; i += 32) {
+        const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(candidate + i));
+        const __m256i b = _mm256_load_si256(reinterpret_cast<const __m256i*>(reference.name + i));
+        const uint32_t equal = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+        const uint32_t terminator = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, zero));
+        if (terminator) {
+            // Keep the bits up to and including the lowest set bit.
+            return (~equal & (terminator ^ (terminator - 1))) == 0;
+        }
+        if (equal != 0xffffffff) {
+            return false;
+        }
+    }
+    return false;
+#elif defined(_M_X64) || defined(__SSE2__)
+    static_assert(XR_MAX_EXTENSION_NAME_SIZE % 16 == 0);
+    const __m128i zero = _mm_setzero_si128();
+    for (size_t i = 0; i < XR_MAX_EXTENSION_NAME_SIZE; i += 16) {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(candidate + i));
+        const __m128i b = _mm_load_si128(reinterpret_cast<const __m128i*>(reference.name + i));
+        const uint32_t equal = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(a, b));
+        const uint32_t terminator = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(a, zero));
+        if (terminator) {
+            return (~equal & (terminator ^ (terminator - 1))) == 0;
+        }
+        if (equal != 0xffff) {
+            return false;
+        }
+    }
+    return false;
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+    static_assert(XR_MAX_EXTENSION_NAME_SIZE % 16 == 0);
+    for (size_t i = 0; i < XR_MAX_EXTENSION_NAME_SIZE; i += 16) {
+        const uint8x16_t a = vld1q_u8(reinterpret_cast<const uint8_t*>(candidate + i));
+        const uint8x16_t b = vld1q_u8(reinterpret_cast<const uint8_t*>(reference.name + i));
+        // There is no movemask on NEON: narrow each byte of the comparison result to a nibble instead.
+        const uint64_t equal =
+            vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(vceqq_u8(a, b)), 4)), 0);
+        const uint64_t terminator =
+            vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(vceqzq_u8(a)), 4)), 0);
+        if (terminator) {
+            return (~equal & (terminator ^ (terminator - 1))) == 0;
+        }
+        if (equal != ~0ull) {
+            return false;
+        }
+    }
+    return false;
+#else
+    return isSameExtensionNameScalar(candidate, reference);
+#endif
+}
+
+// A rule to change the spec version advertised for an extension. The rule only affects the enumeration: the
+// application enables extensions by name, so the version it expects is never seen by the wrapper.
+struct ExtensionVersionRule {
+    ExtensionName name;
+    uint32_t version;
+
+    // Whether the version is an upper bound (clamp) or a replacement (override). An override may advertise a newer
+    // version than the runtime's, for applications that refuse an older revision that is known to work.
+    bool isClamp;
+
+    uint32_t apply(uint32_t runtimeVersion) const {
+        return isClamp ? std::min(version, runtimeVersion) : version;
+    }
+};
+
+// Find the rule for an extension name reported by the runtime. There are only a handful of these rules, so a linear
+// search is fine.
+template <typename Container>
+const ExtensionVersionRule* findExtensionVersionRule(const Container& rules, const char* candidate) {
+    for (const ExtensionVersionRule& rule : rules) {
+        if (isSameExtensionName(candidate, rule.name)) {
+            return &rule;
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,276 @@
+// MIT License
+//
+// Copyright(c) 2023 Matthieu Bucchianeri
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this softwareand associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#pragma once
+
+#include "struct_serializer.h"
+
+// The layout of the flight recorder file: a header, then one ring of entries per thread. Each thread only writes to
+// its own ring, without synchronization, and the file is a mapping of the page cache, so the stores survive a crash
+// of the process. An entry that was never returned from has a null returnedAt. Each entry is followed by room for the
+// serialized arguments of the call, if the recorder captures them. The header tells whether the process exited
+// cleanly, so that a file left behind by a normal exit is not mistaken for a crash.
+struct FlightRecorderHeader {
+    static constexpr char Magic[8] = {'X', 'R', 'F', 'L', 'I', 'G', 'H', 'T'};
+    static constexpr uint32_t CurrentVersion = 3;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t processId;
+    uint32_t threadCount;
+    uint32_t entryCount;
+    int64_t performanceCounterFrequency;
+    uint32_t argumentsCapacity;
+    uint32_t isCleanExit;
+};
+
+struct FlightRecorderEntry {
+    uint64_t nameHash;
+    int64_t enteredAt;
+    int64_t returnedAt;
+    XrResult result;
+    uint32_t argumentsSize;
+};
+
+struct FlightRecorderRing {
+    uint32_t threadId;
+    uint32_t reserved;
+    uint64_t count;
+    uint8_t entries[1];
+};
+
+// A recorder of the last calls that we made to the runtime, into a memory-mapped file. The ring of a thread is given
+// back with releaseThreadRing() when the thread exits, so that only the threads alive at the same time count against
+// the number of rings.
+class FlightRecorder {
+  public:
+    // Records one call for its lifetime. This is a few stores into the thread's ring.
+    class Record {
+      public:
+        Record(FlightRecorder& recorder, uint64_t nameHash) {
+            FlightRecorderRing* const ring = recorder.getThreadRing();
+            if (!ring) {
+                return;
+            }
+
+            LARGE_INTEGER now;
+            QueryPerformanceCounter(&now);
+            m_entry = getEntry(*ring, ring->count, recorder.m_entryCount, recorder.m_argumentsCapacity);
+            m_entry->nameHash = nameHash;
+            m_entry->enteredAt = now.QuadPart;
+            m_entry->returnedAt = 0;
+            m_entry->result = XR_SUCCESS;
+            m_entry->argumentsSize = 0;
+            m_argumentsCapacity = recorder.m_argumentsCapacity;
+            ring->count++;
+        }
+
+        // Serialize the arguments before the call, so that they are in the file if the call never returns. The output
+        // arguments are not initialized yet, so they are recorded as addresses.
+        template <typename... Args>
+        void setArguments(const Args&... args) {
+            if (m_entry && m_argumentsCapacity) {
+                StructWriter writer(reinterpret_cast<uint8_t*>(m_entry + 1), m_argumentsCapacity);
+                serializeInputArguments(writer, args...);
+                m_entry->argumentsSize = (uint32_t)writer.size();
+            }
+        }
+
+        void setResult(XrResult result) {
+            if (m_entry) {
+                LARGE_INTEGER now;
+                QueryPerformanceCounter(&now);
+                m_entry->result = result;
+                m_entry->returnedAt = now.QuadPart;
+            }
+        }
+
+        Record(const Record&) = delete;
+        Record& operator=(const Record&) = delete;
+
+      private:
+        FlightRecorderEntry* m_entry{nullptr};
+        uint32_t m_argumentsCapacity{0};
+    };
+
+    // Create (or replace) the file, which stays open until the process ends. The number of entries per thread must be
+    // a power of two, and the room for the arguments a multiple of 8 bytes. Other threads may already be making calls:
+    // they start recording once the file is ready.
+    bool open(const std::filesystem::path& path,
+              uint32_t threadCount,
+              uint32_t entryCount,
+              uint32_t argumentsCapacity,
+              int64_t performanceCounterFrequency) {
+        const size_t size = getFileSize(threadCount, entryCount, argumentsCapacity);
+        m_file.reset(CreateFileW(path.c_str(),
+                                 GENERIC_READ | GENERIC_WRITE,
+                                 FILE_SHARE_READ,
+                                 nullptr,
+                                 CREATE_ALWAYS,
+                                 FILE_ATTRIBUTE_NORMAL,
+                                 nullptr));
+        if (!m_file) {
+            return false;
+        }
+        m_mapping.reset(CreateFileMappingW(
+            m_file.get(), nullptr, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32), (DWORD)size, nullptr));
+        if (!m_mapping) {
+            return false;
+        }
+        m_view.reset(MapViewOfFile(m_mapping.get(), FILE_MAP_WRITE, 0, 0, size));
+        if (!m_view) {
+            return false;
+        }
+
+        // The mapping of a new file is zeroed.
+        uint8_t* const base = static_cast<uint8_t*>(m_view.get());
+        FlightRecorderHeader* const header = reinterpret_cast<FlightRecorderHeader*>(base);
+        memcpy(header->magic, FlightRecorderHeader::Magic, sizeof(header->magic));
+        header->version = FlightRecorderHeader::CurrentVersion;
+        header->processId = GetCurrentProcessId();
+        header->threadCount = threadCount;
+        header->entryCount = entryCount;
+        header->performanceCounterFrequency = performanceCounterFrequency;
+        header->argumentsCapacity = argumentsCapacity;
+        m_threadCount = threadCount;
+        m_entryCount = entryCount;
+        m_argumentsCapacity = argumentsCapacity;
+        m_base.store(base, std::memory_order_release);
+        return true;
+    }
+
+    bool isOpen() const {
+        return m_base.load(std::memory_order_acquire);
+    }
+
+    // Mark whether the process is exiting normally, for example once its instance is destroyed. A new instance clears
+    // the mark.
+    void setCleanExit(bool isCleanExit) {
+        uint8_t* const base = m_base.load(std::memory_order_acquire);
+        if (base) {
+            reinterpret_cast<volatile FlightRecorderHeader*>(base)->isCleanExit = isCleanExit;
+        }
+    }
+
+    // Give the ring of the calling thread back, when the thread exits.
+    void releaseThreadRing() {
+        FlightRecorderRing*& ring = getThreadRingSlot();
+        if (ring) {
+            // Forget the calls first, so that a crash in between does not attribute them to the next thread.
+            ring->count = 0;
+            InterlockedExchange(reinterpret_cast<volatile LONG*>(&ring->threadId), 0);
+            ring = nullptr;
+        }
+    }
+
+    // Walk the rings of a file that we wrote, for example from a previous run. Returns false if the contents are not
+    // a flight recorder file.
+    template <typename Callback>
+    static bool read(const uint8_t* contents, size_t size, Callback&& callback) {
+        if (size < sizeof(FlightRecorderHeader)) {
+            return false;
+        }
+        const FlightRecorderHeader& header = *reinterpret_cast<const FlightRecorderHeader*>(contents);
+        if (memcmp(header.magic, FlightRecorderHeader::Magic, sizeof(header.magic)) ||
+            header.version != FlightRecorderHeader::CurrentVersion || !header.entryCount ||
+            (header.entryCount & (header.entryCount - 1)) || (header.argumentsCapacity % 8) ||
+            size < getFileSize(header.threadCount, header.entryCount, header.argumentsCapacity)) {
+            return false;
+        }
+        for (uint32_t i = 0; i < header.threadCount; i++) {
+            const FlightRecorderRing& ring = *reinterpret_cast<const FlightRecorderRing*>(
+                contents + sizeof(FlightRecorderHeader) + i * getRingSize(header.entryCount, header.argumentsCapacity));
+            if (ring.threadId) {
+                callback(header, ring);
+            }
+        }
+        return true;
+    }
+
+    // The entry of a ring for the given call count, and the serialized arguments that follow it.
+    static const FlightRecorderEntry& getEntry(const FlightRecorderHeader& header,
+                                               const FlightRecorderRing& ring,
+                                               uint64_t index) {
+        return *getEntry(const_cast<FlightRecorderRing&>(ring), index, header.entryCount, header.argumentsCapacity);
+    }
+
+    static const uint8_t* getArguments(const FlightRecorderEntry& entry) {
+        return reinterpret_cast<const uint8_t*>(&entry + 1);
+    }
+
+  private:
+    static FlightRecorderEntry* getEntry(FlightRecorderRing& ring,
+                                         uint64_t index,
+                                         uint32_t entryCount,
+                                         uint32_t argumentsCapacity) {
+        const size_t stride = sizeof(FlightRecorderEntry) + argumentsCapacity;
+        return reinterpret_cast<FlightRecorderEntry*>(ring.entries + (index & (entryCount - 1)) * stride);
+    }
+
+    static size_t getRingSize(uint32_t entryCount, uint32_t argumentsCapacity) {
+        return offsetof(FlightRecorderRing, entries) + entryCount * (sizeof(FlightRecorderEntry) + argumentsCapacity);
+    }
+
+    static size_t getFileSize(uint32_t threadCount, uint32_t entryCount, uint32_t argumentsCapacity) {
+        return sizeof(FlightRecorderHeader) + threadCount * getRingSize(entryCount, argumentsCapacity);
+    }
+
+    static FlightRecorderRing*& getThreadRingSlot() {
+        thread_local FlightRecorderRing* ring = nullptr;
+        return ring;
+    }
+
+    // Threads are given a free ring on their first call, and keep it until they exit. A thread that finds no free ring
+    // is not recorded.
+    FlightRecorderRing* getThreadRing() {
+        uint8_t* const base = m_base.load(std::memory_order_acquire);
+        if (!base) {
+            return nullptr;
+        }
+        FlightRecorderRing*& ring = getThreadRingSlot();
+        thread_local bool hasLookedForRing = false;
+        if (!ring && !hasLookedForRing) {
+            hasLookedForRing = true;
+            const DWORD threadId = GetCurrentThreadId();
+            for (uint32_t i = 0; i < m_threadCount; i++) {
+                FlightRecorderRing* const candidate = reinterpret_cast<FlightRecorderRing*>(
+                    base + sizeof(FlightRecorderHeader) + i * getRingSize(m_entryCount, m_argumentsCapacity));
+                if (!candidate->threadId &&
+                    !InterlockedCompareExchange(reinterpret_cast<volatile LONG*>(&candidate->threadId), threadId, 0)) {
+                    ring = candidate;
+                    break;
+                }
+            }
+        }
+        return ring;
+    }
+
+    wil::unique_hfile m_file;
+    wil::unique_handle m_mapping;
+    wil::unique_mapview_ptr<void> m_view;
+    // The view, once the file is ready.
+    std::atomic<uint8_t*> m_base{nullptr};
+    uint32_t m_threadCount{0};
+    uint32_t m_entryCount{0};
+    uint32_t m_argumentsCapacity{0};
+};
@@ -0,0 +1,154 @@
+// MIT License
+//
+// Copyright(c) 2023 Matthieu Bucchianeri
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this softwareand associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#pragma once
+
+#include "spsc_queue.h"
+
+// Submits the frames to the runtime from a dedicated thread, so that the application's render thread does not block
+// in xrEndFrame(). Each frame is copied into the arena of a free slot, and handed to the thread through a queue. The
+// frames are submitted in order, and drain() waits for all the frames queued so far, so that the next xrWaitFrame()
+// and xrBeginFrame() reach the runtime after them.
+//
+// acquire() and queue() must be called from one thread at a time, which is the case for xrEndFrame().
+class FrameSubmissionThread {
+  public:
+    using SubmitFunction = XrResult (*)(XrSession session, const XrFrameEndInfo* frameEndInfo);
+    using InitializeFunction = void (*)();
+
+    struct Submission {
+        Arena arena;
+        XrSession session{XR_NULL_HANDLE};
+        const XrFrameEndInfo* frameEndInfo{nullptr};
+    };
+
+    ~FrameSubmissionThread() {
+        // At process exit, the thread was already terminated.
+        if (m_thread.joinable()) {
+            m_thread.detach();
+        }
+    }
+
+    // The initialize() callback runs first on the new thread.
+    void start(SubmitFunction submit, InitializeFunction initialize = nullptr) {
+        if (m_thread.joinable()) {
+            return;
+        }
+        m_submit = submit;
+        m_initialize = initialize;
+        m_isStopping = false;
+        m_thread = std::thread([this] { run(); });
+    }
+
+    void stop() {
+        if (!m_thread.joinable()) {
+            return;
+        }
+        drain();
+        m_isStopping = true;
+        m_wakeUp.SetEvent();
+        m_thread.join();
+    }
+
+    // Wait for a slot whose frame was submitted.
+    Submission& acquire() {
+        const uint64_t queued = m_queuedCount.load();
+        std::unique_lock lock(m_mutex);
+        m_completed.wait(lock, [&] { return queued - m_completedCount.load() < Slots; });
+        return m_submissions[queued % Slots];
+    }
+
+    void queue(Submission& submission) {
+        // There is always room, since acquire() waits for a free slot.
+        m_queue.push(&submission);
+        m_queuedCount++;
+        m_wakeUp.SetEvent();
+    }
+
+    // Wait for all the frames queued so far to be submitted. Safe to call from any thread.
+    void drain() {
+        const uint64_t queued = m_queuedCount.load();
+        if (m_completedCount.load() >= queued) {
+            return;
+        }
+        std::unique_lock lock(m_mutex);
+        m_completed.wait(lock, [&] { return m_completedCount.load() >= queued; });
+    }
+
+    // The first failure since the last call, or else the first qualified success (such as XR_SESSION_LOSS_PENDING or
+    // XR_FRAME_DISCARDED), which could not be returned to the application at the time.
+    XrResult takeResult() {
+        return m_result.exchange(XR_SUCCESS);
+    }
+
+  private:
+    // One frame being submitted while the application records the next one.
+    static constexpr size_t Slots = 2;
+
+    void run() {
+        if (m_initialize) {
+            m_initialize();
+        }
+
+        while (true) {
+            m_wakeUp.wait();
+
+            Submission* submission;
+            while (m_queue.pop(submission)) {
+                const XrResult result = m_submit(submission->session, submission->frameEndInfo);
+                if (result != XR_SUCCESS) {
+                    // A failure replaces a qualified success, but not an earlier failure.
+                    XrResult previous = m_result.load();
+                    while ((previous == XR_SUCCESS || (XR_SUCCEEDED(previous) && XR_FAILED(result))) &&
+                           !m_result.compare_exchange_weak(previous, result)) {
+                    }
+                }
+
+                m_completedCount++;
+                {
+                    // Do not notify between the check and the wait of a waiter.
+                    std::unique_lock lock(m_mutex);
+                }
+                m_completed.notify_all();
+            }
+
+            if (m_isStopping) {
+                break;
+            }
+        }
+    }
+
+    SubmitFunction m_submit{nullptr};
+    InitializeFunction m_initialize{nullptr};
+    std::array<Submission, Slots> m_submissions;
+    SpscQueue<Submission*, Slots> m_queue;
+    std::atomic<uint64_t> m_queuedCount{0};
+    std::atomic<uint64_t> m_completedCount{0};
+    std::atomic<XrResult> m_result{XR_SUCCESS};
+
+    std::mutex m_mutex;
+    std::condition_variable m_completed;
+    wil::unique_event m_wakeUp{wil::EventOptions::None};
+    std::atomic<bool> m_isStopping{false};
+    std::thread m_thread;
+};
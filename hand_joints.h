@@ -0,0 +1,118 @@
+// MIT License
+//
+// Copyright(c) 2023 Matthieu Bucchianeri
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this softwareand associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+// The joints of one hand at one point in time, stored as one array per component so that the extrapolation below is
+// a handful of loops that the compiler can vectorize.
+struct HandJointsSample {
+    static constexpr uint32_t JointCount = XR_HAND_JOINT_COUNT_EXT;
+
+    XrTime time;
+    XrBool32 isActive;
+    alignas(32) float positionX[JointCount];
+    alignas(32) float positionY[JointCount];
+    alignas(32) float positionZ[JointCount];
+    alignas(32) float orientationX[JointCount];
+    alignas(32) float orientationY[JointCount];
+    alignas(32) float orientationZ[JointCount];
+    alignas(32) float orientationW[JointCount];
+    alignas(32) float radius[JointCount];
+    XrSpaceLocationFlags locationFlags[JointCount];
+};
+
+inline void storeHandJoints(const XrHandJointLocationsEXT& locations, XrTime time, HandJointsSample& sample) {
+    sample.time = time;
+    sample.isActive = locations.isActive;
+    for (uint32_t i = 0; i < HandJointsSample::JointCount; i++) {
+        const XrHandJointLocationEXT& joint = locations.jointLocations[i];
+        sample.positionX[i] = joint.pose.position.x;
+        sample.positionY[i] = joint.pose.position.y;
+        sample.positionZ[i] = joint.pose.position.z;
+        sample.orientationX[i] = joint.pose.orientation.x;
+        sample.orientationY[i] = joint.pose.orientation.y;
+        sample.orientationZ[i] = joint.pose.orientation.z;
+        sample.orientationW[i] = joint.pose.orientation.w;
+        sample.radius[i] = joint.radius;
+        sample.locationFlags[i] = joint.locationFlags;
+    }
+}
+
+// Extrapolate the joints linearly from two samples: positions are extrapolated component-wise, and orientations with a
+// normalized linear extrapolation, which is accurate for the small rotations between two hand tracking samples.
+// Joints that are not valid in both samples are copied from the latest sample.
+inline void extrapolateHandJoints(const HandJointsSample& previous,
+                                  const HandJointsSample& latest,
+                                  XrTime time,
+                                  XrHandJointLocationsEXT& locations) {
+    constexpr uint32_t JointCount = HandJointsSample::JointCount;
+    const float alpha = (float)(time - latest.time) / (float)(latest.time - previous.time);
+
+    alignas(32) float positionX[JointCount];
+    alignas(32) float positionY[JointCount];
+    alignas(32) float positionZ[JointCount];
+    for (uint32_t i = 0; i < JointCount; i++) {
+        positionX[i] = latest.positionX[i] + (latest.positionX[i] - previous.positionX[i]) * alpha;
+        positionY[i] = latest.positionY[i] + (latest.positionY[i] - previous.positionY[i]) * alpha;
+        positionZ[i] = latest.positionZ[i] + (latest.positionZ[i] - previous.positionZ[i]) * alpha;
+    }
+
+    alignas(32) float orientationX[JointCount];
+    alignas(32) float orientationY[JointCount];
+    alignas(32) float orientationZ[JointCount];
+    alignas(32) float orientationW[JointCount];
+    for (uint32_t i = 0; i < JointCount; i++) {
+        // q and -q are the same rotation: extrapolate away from the previous sample on the same hemisphere.
+        const float dot = latest.orientationX[i] * previous.orientationX[i] +
+                          latest.orientationY[i] * previous.orientationY[i] +
+                          latest.orientationZ[i] * previous.orientationZ[i] +
+                          latest.orientationW[i] * previous.orientationW[i];
+        const float sign = dot < 0 ? -1.f : 1.f;
+        const float x = latest.orientationX[i] + (latest.orientationX[i] - sign * previous.orientationX[i]) * alpha;
+        const float y = latest.orientationY[i] + (latest.orientationY[i] - sign * previous.orientationY[i]) * alpha;
+        const float z = latest.orientationZ[i] + (latest.orientationZ[i] - sign * previous.orientationZ[i]) * alpha;
+        const float w = latest.orientationW[i] + (latest.orientationW[i] - sign * previous.orientationW[i]) * alpha;
+        const float inverseLength = 1 / std::sqrt(x * x + y * y + z * z + w * w);
+        orientationX[i] = x * inverseLength;
+        orientationY[i] = y * inverseLength;
+        orientationZ[i] = z * inverseLength;
+        orientationW[i] = w * inverseLength;
+    }
+
+    constexpr XrSpaceLocationFlags ValidFlags =
+        XR_SPACE_LOCATION_POSITION_VALID_BIT | XR_SPACE_LOCATION_ORIENTATION_VALID_BIT;
+    locations.isActive = latest.isActive;
+    for (uint32_t i = 0; i < JointCount; i++) {
+        XrHandJointLocationEXT& joint = locations.jointLocations[i];
+        joint.locationFlags = latest.locationFlags[i];
+        joint.radius = latest.radius[i];
+        if ((latest.locationFlags[i] & ValidFlags) == ValidFlags &&
+            (previous.locationFlags[i] & ValidFlags) == ValidFlags) {
+            joint.pose.position = {positionX[i], positionY[i], positionZ[i]};
+            joint.pose.orientation = {orientationX[i], orientationY[i], orientationZ[i], orientationW[i]};
+        } else {
+            joint.pose.position = {latest.positionX[i], latest.positionY[i], latest.positionZ[i]};
+            joint.pose.orientation = {
+                latest.orientationX[i], latest.orientationY[i], latest.orientationZ[i], latest.orientationW[i]};
+        }
+    }
+}
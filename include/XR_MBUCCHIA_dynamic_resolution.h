@@ -0,0 +1,59 @@
+// MIT License
+//
+// Copyright(c) 2023 Matthieu Bucchianeri
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this softwareand associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// An extension implemented by the wrapper (with the dynamicResolution=1 option), for applications to render at the
+// resolution that the wrapper picks based on the measured frame timing.
+//
+// To use it, enable XR_MBUCCHIA_dynamic_resolution at instance creation and chain XrDynamicResolutionScaleMBUCCHIA
+// to the XrFrameState passed to xrWaitFrame(). For that frame, render each projection view into the top-left part of
+// its usual imageRect, with the extent returned by xrScaleImageExtentMBUCCHIA() for each dimension. Keep submitting the
+// full imageRect in xrEndFrame(): the wrapper scales the imageRect of the projection views (and of their depth
+// information) itself, with the same function. The swapchains are never reallocated.
+
+#ifndef XR_MBUCCHIA_dynamic_resolution
+
+#define XR_MBUCCHIA_dynamic_resolution 1
+#define XR_MBUCCHIA_dynamic_resolution_SPEC_VERSION 2
+#define XR_MBUCCHIA_DYNAMIC_RESOLUTION_EXTENSION_NAME "XR_MBUCCHIA_dynamic_resolution"
+
+// Not a registered value: only the wrapper understands it, and removes it from the chain before calling the runtime.
+// The OpenXR registry has no range for private values, so it is taken from the last block of extension values that
+// fits in XrStructureType (extension number 1147483), which the registry, numbering extensions in order, will not
+// reach.
+#define XR_TYPE_DYNAMIC_RESOLUTION_SCALE_MBUCCHIA ((XrStructureType)2147482001)
+
+typedef struct XrDynamicResolutionScaleMBUCCHIA {
+    XrStructureType type;
+    void* XR_MAY_ALIAS next;
+
+    // The fraction of the width and height of the imageRect to render to, in (0, 1].
+    float scale;
+} XrDynamicResolutionScaleMBUCCHIA;
+
+// The width or height of the part of an imageRect to render to: the dimension multiplied by scale in single precision,
+// rounded to the nearest integer (halves up), and at least 1.
+static inline int32_t xrScaleImageExtentMBUCCHIA(int32_t dimension, float scale) {
+    const int32_t scaled = (int32_t)((float)dimension * scale + 0.5f);
+    return scaled > 1 ? scaled : 1;
+}
+
+#endif
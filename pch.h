@@ -25,27 +25,59 @@
 // Standard library.
 #define _CRT_SECURE_NO_WARNINGS
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cmath>
 #include <cstdarg>
+#include <cstddef>
 #include <ctime>
+#include <deque>
 #include <iostream>
 #include <filesystem>
 #include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <shared_mutex>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
 // Windows header files.
 #define WIN32_LEAN_AND_MEAN // Exclude rarely-used stuff from Windows headers
 #define NOMINMAX
 #include <windows.h>
+#include <avrt.h>
 #include <wrl.h>
 #include <wil/resource.h>
 
+// Vulkan, from the SDK. Building without it must be an explicit choice, since it removes features.
+#ifndef WRAPPER_NO_VULKAN
+#if !__has_include(<vulkan/vulkan.h>)
+#error "The Vulkan SDK was not found: set VULKAN_SDK, or build with /p:Vulkan=false to leave out the Vulkan features"
+#endif
+#include <vulkan/vulkan.h>
+#define XR_USE_GRAPHICS_API_VULKAN
+#endif
+
 // OpenXR + Windows-specific definitions.
 #define XR_NO_PROTOTYPES
 #define XR_USE_PLATFORM_WIN32
 #include <openxr/openxr.h>
 #include <openxr/openxr_platform.h>
 #include <openxr/openxr_reflection.h>
+// Newer SDKs list the structure types in a separate header.
+#if __has_include(<openxr/openxr_reflection_structs.h>)
+#include <openxr/openxr_reflection_structs.h>
+#endif
 
 // OpenXR loader interfaces.
 #include <loader_interfaces.h>
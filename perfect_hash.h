@@ -0,0 +1,100 @@
+// MIT License
+//
+// Copyright(c) 2023 Matthieu Bucchianeri
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this softwareand associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+// Seeded 64-bit FNV-1a hash of a name. Usable at compile time.
+constexpr uint64_t hashName(std::string_view name, uint64_t seed = 0) {
+    uint64_t hash = 14695981039346656037ull ^ seed;
+    for (const char c : name) {
+        hash ^= (uint8_t)c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Hash a fixed-width, null-terminated name such as XrExtensionProperties::extensionName.
+inline uint64_t hashName(const char* name, size_t maxLength, uint64_t seed = 0) {
+    return hashName(std::string_view(name, strnlen(name, maxLength)), seed);
+}
+
+// Smallest power of two with a load factor of at most 1/2.
+constexpr size_t perfectHashTableSize(size_t count) {
+    size_t size = 1;
+    while (size < 2 * count) {
+        size *= 2;
+    }
+    return size;
+}
+
+// A set of extension names with a collision-free hash, computed at compile time. A lookup is one hash and at most one
+// name comparison.
+template <size_t Count>
+class PerfectHashSet {
+  public:
+    constexpr PerfectHashSet(const std::array<ExtensionName, Count>& names) : m_names(names), m_slots(), m_seed(0) {
+        // Try seeds until every name lands in its own slot. The configuration must not contain duplicate names.
+        while (!tryBuild()) {
+            if (++m_seed == MaxSeed) {
+                throw "Could not find a perfect hash for the set of names";
+            }
+        }
+    }
+
+    bool contains(const char* candidate) const {
+        if constexpr (Count == 0) {
+            return false;
+        } else {
+            const uint8_t index = m_slots[hashName(candidate, XR_MAX_EXTENSION_NAME_SIZE, m_seed) & (TableSize - 1)];
+            return index != Empty && isSameExtensionName(candidate, m_names[index]);
+        }
+    }
+
+  private:
+    constexpr bool tryBuild() {
+        for (size_t i = 0; i < TableSize; i++) {
+            m_slots[i] = Empty;
+        }
+        for (size_t i = 0; i < Count; i++) {
+            const char* name = m_names[i].name;
+            size_t length = 0;
+            while (length < XR_MAX_EXTENSION_NAME_SIZE && name[length]) {
+                length++;
+            }
+            const size_t slot = hashName(std::string_view(name, length), m_seed) & (TableSize - 1);
+            if (m_slots[slot] != Empty) {
+                return false;
+            }
+            m_slots[slot] = (uint8_t)i;
+        }
+        return true;
+    }
+
+    static constexpr size_t TableSize = perfectHashTableSize(Count);
+    static constexpr uint8_t Empty = 0xff;
+    static constexpr uint64_t MaxSeed = 1 << 16;
+    static_assert(Count < Empty, "Too many names for a perfect hash set");
+
+    std::array<ExtensionName, Count> m_names;
+    uint8_t m_slots[TableSize];
+    uint64_t m_seed;
+};
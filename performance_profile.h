@@ -0,0 +1,35 @@
+// MIT License
+//
+// Copyright(c) 2023 Matthieu Bucchianeri
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this softwareand associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#pragma once
+
+// The performance levels to request through XR_EXT_performance_settings when a session begins. The [runtime] section
+// gives the levels for all applications, and each [app:<name>] section overrides them for the application with that
+// name (from its XrApplicationInfo).
+// The profile also holds the display refresh rate to request through XR_FB_display_refresh_rate, where 0 means the
+// highest rate that the application's frame time sustains.
+struct PerformanceProfile {
+    std::optional<XrPerfSettingsLevelEXT> cpuLevel;
+    std::optional<XrPerfSettingsLevelEXT> gpuLevel;
+    std::optional<float> displayRefreshRate;
+};
@@ -0,0 +1,270 @@
+// MIT License
+//
+// Copyright(c) 2023 Matthieu Bucchianeri
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this softwareand associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include "struct_serializer.h"
+
+// The text rendering of the streams written by the struct serializer. Rendering allocates, so it is best kept off the
+// threads that make the calls.
+
+namespace serializer {
+
+    inline const char* getStructureTypeName(uint32_t type) {
+        switch (type) {
+#define SERIALIZER_ENUM_NAME(name, number)                                                                             \
+    case number:                                                                                                       \
+        return #name;
+            XR_LIST_ENUM_XrStructureType(SERIALIZER_ENUM_NAME)
+        default:
+            return nullptr;
+        }
+    }
+
+    inline const char* getResultName(int64_t result) {
+        switch (result) {
+            XR_LIST_ENUM_XrResult(SERIALIZER_ENUM_NAME)
+#undef SERIALIZER_ENUM_NAME
+        default:
+            return nullptr;
+        }
+    }
+
+    inline bool renderValue(std::string& out, StructReader& reader, uint32_t depth);
+
+    // The members of a structure, minus its type (which is implied by the structure).
+    inline bool renderMembers(std::string& out,
+                              StructReader& reader,
+                              const char* const* names,
+                              size_t count,
+                              uint32_t type,
+                              uint32_t depth) {
+        out += '{';
+        for (size_t i = 0; i < count; i++) {
+            if (i) {
+                out += ", ";
+            }
+            out += names[i];
+            out += '=';
+            if (isNamed(names[i], "type")) {
+                const char* const typeName = getStructureTypeName(type);
+                out += typeName ? typeName : std::to_string(type);
+            } else if (!renderValue(out, reader, depth + 1)) {
+                return false;
+            }
+        }
+        out += '}';
+        return true;
+    }
+
+    // Render one value of the stream. Returns false if the stream ends or is corrupted.
+    inline bool renderValue(std::string& out, StructReader& reader, uint32_t depth) {
+        if (depth >= MaxDepth * 4) {
+            return false;
+        }
+        SerializedTag tag;
+        if (!reader.readTag(tag)) {
+            return false;
+        }
+        switch (tag) {
+        case SerializedTag::Null:
+            out += "nullptr";
+            return true;
+
+        case SerializedTag::Unsigned: {
+            uint64_t value;
+            if (!reader.readVarint(value)) {
+                return false;
+            }
+            out += std::to_string(value);
+            return true;
+        }
+
+        case SerializedTag::Signed:
+        case SerializedTag::Time: {
+            int64_t value;
+            if (tag == SerializedTag::Time ? !reader.readTime(value) : !reader.readSigned(value)) {
+                return false;
+            }
+            out += std::to_string(value);
+            return true;
+        }
+
+        case SerializedTag::Float:
+        case SerializedTag::Double: {
+            double value;
+            if (tag == SerializedTag::Float) {
+                float single;
+                if (!reader.readBytes(&single, sizeof(single))) {
+                    return false;
+                }
+                value = single;
+            } else if (!reader.readBytes(&value, sizeof(value))) {
+                return false;
+            }
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%g", value);
+            out += buf;
+            return true;
+        }
+
+        case SerializedTag::String: {
+            uint64_t length;
+            char buf[MaxStringLength];
+            if (!reader.readVarint(length) || length > sizeof(buf) || !reader.readBytes(buf, (size_t)length)) {
+                return false;
+            }
+            out += '"';
+            out.append(buf, (size_t)length);
+            out += '"';
+            return true;
+        }
+
+        case SerializedTag::Address: {
+            uint64_t address;
+            if (!reader.readVarint(address)) {
+                return false;
+            }
+            char buf[32];
+            snprintf(buf, sizeof(buf), "0x%llx", (unsigned long long)address);
+            out += buf;
+            return true;
+        }
+
+        case SerializedTag::Reference:
+            out += '&';
+            return renderValue(out, reader, depth + 1);
+
+        case SerializedTag::StructureType: {
+            uint64_t type;
+            if (!reader.readVarint(type)) {
+                return false;
+            }
+            const char* const name = getStructureTypeName((uint32_t)type);
+            out += name ? name : std::to_string(type);
+            return true;
+        }
+
+        case SerializedTag::Result: {
+            int64_t result;
+            if (!reader.readSigned(result)) {
+                return false;
+            }
+            const char* const name = getResultName(result);
+            out += name ? name : std::to_string(result);
+            return true;
+        }
+
+        case SerializedTag::Array: {
+            uint64_t extent;
+            if (!reader.readVarint(extent)) {
+                return false;
+            }
+            out += '[';
+            for (uint64_t i = 0; i < std::min<uint64_t>(extent, MaxArrayElements); i++) {
+                if (i) {
+                    out += ", ";
+                }
+                if (!renderValue(out, reader, depth + 1)) {
+                    return false;
+                }
+            }
+            out += extent > MaxArrayElements ? ", ...]" : "]";
+            return true;
+        }
+
+        case SerializedTag::Structure: {
+            uint64_t type;
+            if (!reader.readVarint(type)) {
+                return false;
+            }
+            switch (type) {
+#define SERIALIZER_MEMBER_NAME(member) #member,
+#define SERIALIZER_RENDER_TYPED(name, type)                                                                            \
+    case type: {                                                                                                       \
+        static const char* const names[] = {XR_LIST_STRUCT_##name(SERIALIZER_MEMBER_NAME)};                            \
+        out += #name;                                                                                                  \
+        return renderMembers(out, reader, names, std::size(names), type, depth);                                       \
+    }
+                XR_LIST_STRUCTURE_TYPES(SERIALIZER_RENDER_TYPED)
+#undef SERIALIZER_RENDER_TYPED
+            default:
+                // The stream comes from a build that knows more structures than us.
+                return false;
+            }
+        }
+
+        case SerializedTag::UntypedStructure: {
+            uint64_t id;
+            if (!reader.readVarint(id)) {
+                return false;
+            }
+            switch (static_cast<SerializedUntypedStructure>(id)) {
+#define SERIALIZER_RENDER_UNTYPED(name)                                                                                \
+    case SerializedUntypedStructure::name: {                                                                           \
+        static const char* const names[] = {XR_LIST_STRUCT_##name(SERIALIZER_MEMBER_NAME)};                            \
+        return renderMembers(out, reader, names, std::size(names), 0, depth);                                          \
+    }
+                SERIALIZER_UNTYPED_STRUCTURES(SERIALIZER_RENDER_UNTYPED)
+#undef SERIALIZER_RENDER_UNTYPED
+#undef SERIALIZER_MEMBER_NAME
+            default:
+                return false;
+            }
+        }
+
+        case SerializedTag::UnknownStructure: {
+            uint64_t type;
+            if (!reader.readVarint(type)) {
+                return false;
+            }
+            const char* const name = getStructureTypeName((uint32_t)type);
+            out += "{type=";
+            out += name ? name : std::to_string(type);
+            out += ", next=";
+            if (!renderValue(out, reader, depth + 1)) {
+                return false;
+            }
+            out += ", ...}";
+            return true;
+        }
+
+        case SerializedTag::Opaque:
+            out += "{...}";
+            return true;
+
+        default:
+            return false;
+        }
+    }
+
+} // namespace serializer
+
+// Render the next value of a stream, for example one argument of a call. A value that is cut by the end of the stream
+// is rendered up to where it was cut, followed by "...".
+inline std::string renderSerializedValue(StructReader& reader) {
+    std::string out;
+    if (!serializer::renderValue(out, reader, 0)) {
+        out += "...";
+    }
+    return out;
+}
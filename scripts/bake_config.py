@@ -0,0 +1,341 @@
+# MIT License
+#
+# Copyright(c) 2023 Matthieu Bucchianeri
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this softwareand associated documentation files(the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions :
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+# Turn a configuration file into a header with constexpr tables, for builds with BakeConfig=true.
+# Usage: bake_config.py <InstanceExtensionsWrapper.cfg> <baked_config.h>
+
+import os
+import sys
+
+XR_MAX_EXTENSION_NAME_SIZE = 128
+
+def cpp_string(value):
+    return '"' + value.replace('\\', '\\\\').replace('"', '\\"') + '"'
+
+# The conversions below mirror applyOption() in dllmain.cpp, so that the values are typed at build time rather than
+# parsed at load time.
+def cpp_bool(value):
+    return 'true' if value in ('1', 'true') else 'false'
+
+def cpp_uint(maximum=None, align=1):
+    def convert(value):
+        number = int(value)
+        if number < 0:
+            raise ValueError(value)
+        if maximum is not None:
+            number = min(number, maximum)
+        return str((number + align - 1) // align * align)
+    return convert
+
+def cpp_float(minimum, maximum):
+    def convert(value):
+        return repr(min(max(float(value), minimum), maximum)) + 'f'
+    return convert
+
+def cpp_double(value):
+    return repr(float(value))
+
+def cpp_choice(choices):
+    def convert(value):
+        if value not in choices:
+            raise ValueError(value)
+        return choices[value]
+    return convert
+
+PERFORMANCE_LEVELS = {
+    'powerSavings': 'XR_PERF_SETTINGS_LEVEL_POWER_SAVINGS_EXT',
+    'sustainedLow': 'XR_PERF_SETTINGS_LEVEL_SUSTAINED_LOW_EXT',
+    'sustainedHigh': 'XR_PERF_SETTINGS_LEVEL_SUSTAINED_HIGH_EXT',
+    'boost': 'XR_PERF_SETTINGS_LEVEL_BOOST_EXT',
+}
+
+def cpp_refresh_rate(value):
+    return '0.f' if value == 'auto' else repr(max(0.0, float(value))) + 'f'
+
+# The functions that have a stub, from FUNCTION_STUBS in dllmain.cpp. The build also checks the baked overrides with a
+# static_assert, but rejecting them here gives a better error.
+STUBBED_FUNCTIONS = (
+    'xrGetVisibilityMaskKHR',
+    'xrPerfSettingsSetPerformanceLevelEXT',
+    'xrSetDebugUtilsObjectNameEXT',
+    'xrSubmitDebugUtilsMessageEXT',
+    'xrSessionBeginDebugUtilsLabelRegionEXT',
+    'xrSessionEndDebugUtilsLabelRegionEXT',
+    'xrSessionInsertDebugUtilsLabelEXT',
+)
+
+# The options that go to a single variable: the variable, its type and the conversion of the value.
+OPTIONS = {
+    'benchmarkMasking': ('benchmarkMasking', 'bool', cpp_bool),
+    'functionResolution': ('lazyResolution', 'bool', lambda value: cpp_bool('true' if value == 'lazy' else '')),
+    'benchmarkResolution': ('benchmarkResolution', 'bool', cpp_bool),
+    'flightRecorderSize': ('flightRecorderSize', 'uint32_t', cpp_uint(1 << 16)),
+    'flightRecorderArguments': ('flightRecorderArguments', 'uint32_t', cpp_uint(1 << 12, 8)),
+    'hangWatchdogThreshold': ('hangWatchdogThreshold', 'uint32_t', cpp_uint()),
+    'slowCallThreshold': ('slowCallThreshold', 'uint32_t', cpp_uint()),
+    'asyncEndFrame': ('asyncEndFrame', 'bool', cpp_bool),
+    'asyncEndFrameVulkan': ('asyncEndFrameVulkan', 'bool', cpp_bool),
+    'frameThreadPriority': ('frameThreadPriority', 'int', cpp_choice({
+        'normal': 'THREAD_PRIORITY_NORMAL',
+        'aboveNormal': 'THREAD_PRIORITY_ABOVE_NORMAL',
+        'highest': 'THREAD_PRIORITY_HIGHEST',
+        'timeCritical': 'THREAD_PRIORITY_TIME_CRITICAL',
+    })),
+    'frameThreadAffinity': ('frameThreadAffinity', 'DWORD_PTR', lambda value: hex(int(value, 0))),
+    'frameThreadTask': ('frameThreadTask', 'std::wstring_view', lambda value: 'L' + cpp_string(value)),
+    'efficientBackgroundThreads': ('efficientBackgroundThreads', 'bool', cpp_bool),
+    'dynamicResolution': ('dynamicResolution', 'bool', cpp_bool),
+    'dynamicResolutionMinScale': ('dynamicResolutionMinScale', 'float', cpp_float(0.1, 1.0)),
+    'stepDownPerformanceLevel': ('stepDownPerformanceLevel', 'bool', cpp_bool),
+    'handTrackingRate': ('handTrackingRate', 'double', cpp_double),
+    'shareSpaces': ('shareSpaces', 'bool', cpp_bool),
+    'synthesizeVisibilityMask': ('synthesizeVisibilityMask', 'bool', cpp_bool),
+    'cacheVisibilityMasks': ('cacheVisibilityMasks', 'bool', cpp_bool),
+    'cacheProperties': ('cacheProperties', 'bool', cpp_bool),
+    'localTimeConversion': ('localTimeConversion', 'bool', cpp_bool),
+}
+
+# The options of a performance profile, from the [runtime] section or from an [app:<name>] section.
+PROFILE_OPTIONS = {
+    'cpuPerformanceLevel': ('cpuLevel', cpp_choice(PERFORMANCE_LEVELS)),
+    'gpuPerformanceLevel': ('gpuLevel', cpp_choice(PERFORMANCE_LEVELS)),
+    'displayRefreshRate': ('displayRefreshRate', cpp_refresh_rate),
+}
+
+def new_profile():
+    return {'cpuLevel': 'std::nullopt', 'gpuLevel': 'std::nullopt', 'displayRefreshRate': 'std::nullopt'}
+
+def cpp_profile(profile):
+    return f'PerformanceProfile{{{profile["cpuLevel"]}, {profile["gpuLevel"]}, {profile["displayRefreshRate"]}}}'
+
+def constant_name(variable):
+    return variable[0].upper() + variable[1:]
+
+def emit_rules(lines, index, rules):
+    extensions_to_mask = rules['extensions_to_mask']
+    lines.append(f'    constexpr PerfectHashSet<{len(extensions_to_mask)}> ExtensionsToMask{index}(')
+    lines.append(f'        std::array<ExtensionName, {len(extensions_to_mask)}>{{{{')
+    for extension in extensions_to_mask:
+        lines.append(f'            ExtensionName{{{cpp_string(extension)}}},')
+    lines.append('        }});')
+    extension_versions = rules['extension_versions']
+    lines.append(f'    constexpr std::array<ExtensionVersionRule, {len(extension_versions)}> ExtensionVersions{index}{{{{')
+    for extension, version, is_clamp in extension_versions:
+        clamp = 'true' if is_clamp else 'false'
+        lines.append(f'        ExtensionVersionRule{{ExtensionName{{{cpp_string(extension)}}}, {version}, {clamp}}},')
+    lines.append('    }};')
+    return (f'ExtensionRules{{\n'
+            f'            [](const char* extensionName) {{ return ExtensionsToMask{index}.contains(extensionName); }},\n'
+            f'            [](const char* extensionName) {{\n'
+            f'                return findExtensionVersionRule(ExtensionVersions{index}, extensionName);\n'
+            f'            }}}}')
+
+def new_rules():
+    return {'extensions_to_mask': [], 'extension_versions': []}
+
+def main(config_path, header_path):
+    runtime = None
+    options = {}
+    function_overrides = []
+    vulkan_extensions_to_mask = []
+    vulkan_layers_to_mask = []
+
+    # The performance profile of the [runtime] section, and the one of each [app:<name>] section.
+    default_profile = None
+    app_profiles = {}
+    app_name = ''
+
+    # The rules for the runtime's extensions, then for each [layer:<name>] section.
+    rules = {'': new_rules()}
+    layer_name = ''
+
+    with open(config_path, 'r') as config_file:
+        for line_number, line in enumerate(config_file.read().splitlines(), start=1):
+            if not line:
+                continue
+            if line.startswith('[') and line.endswith(']'):
+                section = line[1:-1]
+                if section == 'runtime':
+                    layer_name = ''
+                    app_name = ''
+                elif section.startswith('layer:'):
+                    layer_name = section[len('layer:'):]
+                    app_name = ''
+                    rules.setdefault(layer_name, new_rules())
+                elif section.startswith('app:'):
+                    layer_name = ''
+                    app_name = section[len('app:'):]
+                else:
+                    raise SystemExit(f'{config_path}({line_number}): Unrecognized section')
+                continue
+
+            name, separator, value = line.partition('=')
+            if not separator:
+                raise SystemExit(f'{config_path}({line_number}): Improperly formatted option')
+
+            if app_name or name in PROFILE_OPTIONS:
+                if name not in PROFILE_OPTIONS:
+                    raise SystemExit(f'{config_path}({line_number}): Option is not allowed in an app section')
+                if layer_name:
+                    raise SystemExit(f'{config_path}({line_number}): Option is not allowed in a layer section')
+                field, convert = PROFILE_OPTIONS[name]
+                if app_name:
+                    profile = app_profiles.setdefault(app_name, new_profile())
+                else:
+                    default_profile = default_profile or new_profile()
+                    profile = default_profile
+                try:
+                    profile[field] = convert(value)
+                except ValueError:
+                    raise SystemExit(f'{config_path}({line_number}): Invalid value for option {name}')
+            elif name == 'maskExtension':
+                if len(value) >= XR_MAX_EXTENSION_NAME_SIZE:
+                    raise SystemExit(f'{config_path}({line_number}): Extension name is too long')
+                extensions_to_mask = rules[layer_name]['extensions_to_mask']
+                if value not in extensions_to_mask:
+                    extensions_to_mask.append(value)
+            elif name in ('clampExtensionVersion', 'overrideExtensionVersion'):
+                extension, separator, version = value.rpartition(':')
+                if not separator or len(extension) >= XR_MAX_EXTENSION_NAME_SIZE:
+                    raise SystemExit(f'{config_path}({line_number}): Improperly formatted extension version')
+                rules[layer_name]['extension_versions'].append(
+                    (extension, int(version), name == 'clampExtensionVersion'))
+            elif layer_name:
+                raise SystemExit(f'{config_path}({line_number}): Option is not allowed in a layer section')
+            elif name == 'runtime':
+                runtime = value
+            elif name in ('maskFunction', 'stubFunction'):
+                if name == 'stubFunction' and value not in STUBBED_FUNCTIONS:
+                    raise SystemExit(f'{config_path}({line_number}): No stub available for function {value}')
+                function_overrides.append((value, name == 'stubFunction'))
+            elif name == 'maskVulkanExtension':
+                vulkan_extensions_to_mask.append(value)
+            elif name == 'maskVulkanLayer':
+                vulkan_layers_to_mask.append(value)
+            elif name in OPTIONS:
+                variable, cpp_type, convert = OPTIONS[name]
+                try:
+                    options[variable] = (cpp_type, convert(value))
+                except ValueError:
+                    raise SystemExit(f'{config_path}({line_number}): Invalid value for option {name}')
+            else:
+                raise SystemExit(f'{config_path}({line_number}): Unrecognized option')
+
+    if runtime is None:
+        raise SystemExit(f'{config_path}: Missing runtime option')
+
+    lines = []
+    lines.append(f'// Generated by bake_config.py from {os.path.basename(config_path)}. Do not edit.')
+    lines.append('')
+    lines.append('#pragma once')
+    lines.append('')
+    lines.append('namespace baked {')
+    lines.append('')
+    lines.append('    struct ExtensionRules {')
+    lines.append('        bool (*isMaskedFunction)(const char* extensionName);')
+    lines.append('        const ExtensionVersionRule* (*findVersionRuleFunction)(const char* extensionName);')
+    lines.append('')
+    lines.append('        bool isMasked(const char* extensionName) const {')
+    lines.append('            return isMaskedFunction(extensionName);')
+    lines.append('        }')
+    lines.append('')
+    lines.append('        const ExtensionVersionRule* findVersionRule(const char* extensionName) const {')
+    lines.append('            return findVersionRuleFunction(extensionName);')
+    lines.append('        }')
+    lines.append('    };')
+    lines.append('')
+    lines.append('    struct FunctionOverride {')
+    lines.append('        uint64_t nameHash;')
+    lines.append('        bool isStub;')
+    lines.append('    };')
+    lines.append('')
+    lines.append(f'    constexpr wchar_t RuntimeLibrary[] = L{cpp_string(runtime + ".dll")};')
+    lines.append('')
+    lines.append(f'    constexpr std::array<FunctionOverride, {len(function_overrides)}> FunctionOverrides{{{{')
+    for function_name, is_stub in function_overrides:
+        stub = 'true' if is_stub else 'false'
+        lines.append(f'        FunctionOverride{{hashName({cpp_string(function_name)}), {stub}}},')
+    lines.append('    }};')
+    lines.append('')
+
+    layer_rules = []
+    for index, (layer_name, layer) in enumerate(rules.items()):
+        initializer = emit_rules(lines, index, layer)
+        if layer_name:
+            layer_rules.append((layer_name, initializer))
+        else:
+            lines.append(f'    constexpr ExtensionRules RuntimeRules = {initializer};')
+        lines.append('')
+
+    lines.append(f'    constexpr std::array<std::pair<std::string_view, ExtensionRules>, {len(layer_rules)}> LayerRules{{{{')
+    for layer_name, initializer in layer_rules:
+        lines.append(f'        std::pair<std::string_view, ExtensionRules>{{{cpp_string(layer_name)}, {initializer}}},')
+    lines.append('    }};')
+    lines.append('')
+    lines.append('    constexpr ExtensionRules NoRules{[](const char*) { return false; },')
+    lines.append('                                    [](const char*) -> const ExtensionVersionRule* { return nullptr; }};')
+    lines.append('')
+    for variable, names in (('VulkanExtensionsToMask', vulkan_extensions_to_mask),
+                            ('VulkanLayersToMask', vulkan_layers_to_mask)):
+        lines.append(f'    constexpr std::array<std::string_view, {len(names)}> {variable}{{{{')
+        for name in names:
+            lines.append(f'        {cpp_string(name)},')
+        lines.append('    }};')
+        lines.append('')
+
+    # The options are assigned to their variables at load time with BAKED_OPTIONS(), without parsing.
+    if default_profile:
+        options['defaultPerformanceProfile'] = ('PerformanceProfile', cpp_profile(default_profile))
+    for variable, (cpp_type, value) in options.items():
+        lines.append(f'    constexpr {cpp_type} {constant_name(variable)} = {value};')
+    if options:
+        lines.append('')
+    lines.append('#define BAKED_OPTIONS(_)' + ''.join(
+        f' \\\n    _({variable}, {constant_name(variable)})' for variable in options))
+    lines.append('')
+
+    lines.append(f'    constexpr std::array<std::pair<std::string_view, PerformanceProfile>, {len(app_profiles)}> '
+                 f'AppPerformanceProfiles{{{{')
+    for app, profile in app_profiles.items():
+        lines.append(f'        std::pair<std::string_view, PerformanceProfile>{{{cpp_string(app)}, '
+                     f'{cpp_profile(profile)}}},')
+    lines.append('    }};')
+    lines.append('')
+    lines.append('} // namespace baked')
+    lines.append('')
+
+    content = '\n'.join(lines)
+
+    # Avoid touching the header (and rebuilding everything) when nothing changed.
+    try:
+        with open(header_path, 'r') as header_file:
+            if header_file.read() == content:
+                return
+    except OSError:
+        pass
+    with open(header_path, 'w') as header_file:
+        header_file.write(content)
+
+if __name__ == '__main__':
+    if len(sys.argv) != 3:
+        raise SystemExit(f'Usage: {sys.argv[0]} <config> <header>')
+    main(sys.argv[1], sys.argv[2])
@@ -0,0 +1,155 @@
+// MIT License
+//
+// Copyright(c) 2023 Matthieu Bucchianeri
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this softwareand associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include "struct_serializer.h"
+
+// Logs the slow calls to the runtime from a background thread. The calling thread only serializes the arguments
+// (without allocating) and copies them into a free slot, and the background thread renders them, which allocates and
+// takes the log file lock. When all the slots are in use, the call is dropped, and the number of dropped calls is
+// reported with the next call that is logged.
+class SlowCallLogger {
+  public:
+    // The room for the serialized arguments of each call, in bytes. The arguments that do not fit are cut.
+    static constexpr size_t MaxArgumentsSize = 8192;
+
+    struct Call {
+        const char* name{nullptr};
+        double milliseconds{0};
+        XrResult result{XR_SUCCESS};
+        uint32_t droppedCount{0};
+        size_t size{0};
+        uint8_t arguments[MaxArgumentsSize];
+    };
+
+    // Called from the background thread for each call, in order.
+    using LogFunction = void (*)(const Call& call);
+    using InitializeFunction = void (*)();
+
+    ~SlowCallLogger() {
+        // At process exit, the thread was already terminated.
+        if (m_thread.joinable()) {
+            m_thread.detach();
+        }
+    }
+
+    bool isEnabled() const {
+        return m_isEnabled.load(std::memory_order_relaxed);
+    }
+
+    // The initialize() callback runs first on the new thread.
+    void start(LogFunction log, InitializeFunction initialize = nullptr) {
+        if (m_thread.joinable()) {
+            return;
+        }
+        m_log = log;
+        m_initialize = initialize;
+        m_isStopping = false;
+        m_isEnabled = true;
+        m_thread = std::thread([this] { run(); });
+    }
+
+    // Log the calls queued so far, then stop the thread.
+    void stop() {
+        if (!m_thread.joinable()) {
+            return;
+        }
+        m_isEnabled = false;
+        m_isStopping = true;
+        m_wakeUp.SetEvent();
+        m_thread.join();
+    }
+
+    template <typename... Args>
+    void queue(const char* name, double milliseconds, XrResult result, const Args&... args) {
+        if (!isEnabled()) {
+            return;
+        }
+
+        uint8_t buffer[MaxArgumentsSize];
+        StructWriter writer(buffer, sizeof(buffer));
+        serializeArguments(writer, args...);
+        {
+            std::unique_lock lock(m_mutex);
+            if (m_queuedCount - m_loggedCount == Slots) {
+                m_droppedCount++;
+                return;
+            }
+            Call& call = m_calls[m_queuedCount % Slots];
+            call.name = name;
+            call.milliseconds = milliseconds;
+            call.result = result;
+            call.droppedCount = m_droppedCount;
+            call.size = writer.size();
+            memcpy(call.arguments, buffer, writer.size());
+            m_droppedCount = 0;
+            m_queuedCount++;
+        }
+        m_wakeUp.SetEvent();
+    }
+
+  private:
+    static constexpr size_t Slots = 16;
+
+    void run() {
+        if (m_initialize) {
+            m_initialize();
+        }
+
+        while (true) {
+            m_wakeUp.wait();
+
+            while (true) {
+                {
+                    std::unique_lock lock(m_mutex);
+                    if (m_loggedCount == m_queuedCount) {
+                        break;
+                    }
+                }
+
+                // The slot is ours until we move past it, so we can log it without the lock.
+                m_log(m_calls[m_loggedCount % Slots]);
+                std::unique_lock lock(m_mutex);
+                m_loggedCount++;
+            }
+
+            if (m_isStopping) {
+                break;
+            }
+        }
+    }
+
+    LogFunction m_log{nullptr};
+    InitializeFunction m_initialize{nullptr};
+    std::atomic<bool> m_isEnabled{false};
+    std::atomic<bool> m_isStopping{false};
+
+    std::mutex m_mutex;
+    std::array<Call, Slots> m_calls;
+    uint64_t m_queuedCount{0};
+    uint64_t m_loggedCount{0};
+    uint32_t m_droppedCount{0};
+
+    wil::unique_event m_wakeUp{wil::EventOptions::None};
+    std::thread m_thread;
+};
@@ -0,0 +1,433 @@
+// MIT License
+//
+// Copyright(c) 2023 Matthieu Bucchianeri
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this softwareand associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#pragma once
+
+// A compact binary encoding of the structures passed to the runtime, generated from the reflection headers. Each value
+// starts with a tag, so that the stream can be rendered (see pretty_printer.h) without knowing the signature of the
+// function that it came from. Integers are varints (zigzag for signed values), and timestamps are deltas from the
+// previous timestamp in the stream, so a stream must be rendered from its start.
+
+// The structures without a type that appear as members or arguments. The reflection headers only list the structures
+// with a type, so we list these ones ourselves.
+#define SERIALIZER_UNTYPED_STRUCTURES(_)                                                                               \
+    _(XrVector2f)                                                                                                      \
+    _(XrVector3f)                                                                                                      \
+    _(XrQuaternionf)                                                                                                   \
+    _(XrPosef)                                                                                                         \
+    _(XrFovf)                                                                                                          \
+    _(XrOffset2Di)                                                                                                     \
+    _(XrExtent2Di)                                                                                                     \
+    _(XrRect2Di)                                                                                                       \
+    _(XrOffset2Df)                                                                                                     \
+    _(XrExtent2Df)                                                                                                     \
+    _(XrRect2Df)                                                                                                       \
+    _(XrColor4f)                                                                                                       \
+    _(XrSwapchainSubImage)                                                                                             \
+    _(XrApplicationInfo)                                                                                               \
+    _(XrSystemGraphicsProperties)                                                                                      \
+    _(XrSystemTrackingProperties)                                                                                      \
+    _(XrHandJointLocationEXT)                                                                                          \
+    _(XrHandJointVelocityEXT)                                                                                          \
+    _(XrActionSuggestedBinding)                                                                                        \
+    _(XrActiveActionSet)
+
+enum class SerializedTag : uint8_t {
+    Null,
+    Unsigned,
+    Signed,
+    Float,
+    Double,
+    Time,
+    String,
+    Address,
+    Reference,
+    StructureType,
+    Result,
+    Array,
+    Structure,
+    UntypedStructure,
+    UnknownStructure,
+    Opaque,
+};
+
+// The index of an untyped structure in the encoding.
+enum class SerializedUntypedStructure : uint32_t {
+#define SERIALIZER_UNTYPED_ID(name) name,
+    SERIALIZER_UNTYPED_STRUCTURES(SERIALIZER_UNTYPED_ID)
+#undef SERIALIZER_UNTYPED_ID
+        Count
+};
+
+// Writes into a buffer supplied by the caller. Each value starts with its tag, and the room is checked for each value:
+// when one does not fit, the part of it that was written is rolled back, so that the stream ends on the last complete
+// value, and everything after is dropped.
+class StructWriter {
+  public:
+    StructWriter(uint8_t* buffer, size_t capacity) : m_buffer(buffer), m_capacity(capacity) {
+    }
+
+    void writeTag(SerializedTag tag) {
+        m_valueStart = m_size;
+        const uint8_t byte = static_cast<uint8_t>(tag);
+        writeBytes(&byte, 1);
+    }
+
+    void writeVarint(uint64_t value) {
+        uint8_t bytes[10];
+        size_t size = 0;
+        do {
+            bytes[size] = (uint8_t)(value & 0x7f) | (value > 0x7f ? 0x80 : 0);
+            value >>= 7;
+            size++;
+        } while (value);
+        writeBytes(bytes, size);
+    }
+
+    void writeSigned(int64_t value) {
+        writeVarint(((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+    }
+
+    void writeTime(XrTime time) {
+        writeSigned(time - m_lastTime);
+        m_lastTime = time;
+    }
+
+    void writeBytes(const void* data, size_t size) {
+        if (m_isTruncated) {
+            return;
+        }
+        if (size > m_capacity - m_size) {
+            m_size = m_valueStart;
+            m_isTruncated = true;
+            return;
+        }
+        memcpy(m_buffer + m_size, data, size);
+        m_size += size;
+    }
+
+    size_t size() const {
+        return m_size;
+    }
+
+    bool isTruncated() const {
+        return m_isTruncated;
+    }
+
+  private:
+    uint8_t* const m_buffer;
+    const size_t m_capacity;
+    size_t m_size{0};
+    size_t m_valueStart{0};
+    bool m_isTruncated{false};
+    XrTime m_lastTime{0};
+};
+
+// Reads a stream from StructWriter. All the functions return false at the end of the stream.
+class StructReader {
+  public:
+    StructReader(const uint8_t* buffer, size_t size) : m_buffer(buffer), m_size(size) {
+    }
+
+    bool readTag(SerializedTag& tag) {
+        uint8_t byte;
+        if (!readBytes(&byte, 1)) {
+            return false;
+        }
+        tag = static_cast<SerializedTag>(byte);
+        return true;
+    }
+
+    bool readVarint(uint64_t& value) {
+        value = 0;
+        for (uint32_t shift = 0; shift < 64; shift += 7) {
+            uint8_t byte;
+            if (!readBytes(&byte, 1)) {
+                return false;
+            }
+            value |= (uint64_t)(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool readSigned(int64_t& value) {
+        uint64_t encoded;
+        if (!readVarint(encoded)) {
+            return false;
+        }
+        value = (int64_t)(encoded >> 1) ^ -(int64_t)(encoded & 1);
+        return true;
+    }
+
+    bool readTime(XrTime& time) {
+        int64_t delta;
+        if (!readSigned(delta)) {
+            return false;
+        }
+        m_lastTime += delta;
+        time = m_lastTime;
+        return true;
+    }
+
+    bool readBytes(void* data, size_t size) {
+        if (size > m_size - m_offset) {
+            return false;
+        }
+        memcpy(data, m_buffer + m_offset, size);
+        m_offset += size;
+        return true;
+    }
+
+    bool isAtEnd() const {
+        return m_offset == m_size;
+    }
+
+  private:
+    const uint8_t* const m_buffer;
+    const size_t m_size;
+    size_t m_offset{0};
+    XrTime m_lastTime{0};
+};
+
+namespace serializer {
+
+    // Long arrays are opaque buffers, such as the payload of XrEventDataBuffer, and long strings are truncated.
+    constexpr size_t MaxArrayElements = 16;
+    constexpr size_t MaxStringLength = 256;
+
+    // The depth bounds the output if a chain loops, and the recursion if a stream is corrupted.
+    constexpr uint32_t MaxDepth = 8;
+
+    template <typename T>
+    struct IsTypedStructure : std::false_type {};
+    template <typename T>
+    struct UntypedStructureId {
+        static constexpr SerializedUntypedStructure value = SerializedUntypedStructure::Count;
+    };
+
+#define SERIALIZER_DECLARE(name, ...) inline void serialize(StructWriter& writer, const name& value, uint32_t depth);
+#define SERIALIZER_TYPED_TRAIT(name, type)                                                                             \
+    template <>                                                                                                        \
+    struct IsTypedStructure<name> : std::true_type {};
+#define SERIALIZER_UNTYPED_TRAIT(name)                                                                                 \
+    template <>                                                                                                        \
+    struct UntypedStructureId<name> {                                                                                  \
+        static constexpr SerializedUntypedStructure value = SerializedUntypedStructure::name;                          \
+    };
+    XR_LIST_STRUCTURE_TYPES(SERIALIZER_DECLARE)
+    SERIALIZER_UNTYPED_STRUCTURES(SERIALIZER_DECLARE)
+    XR_LIST_STRUCTURE_TYPES(SERIALIZER_TYPED_TRAIT)
+    SERIALIZER_UNTYPED_STRUCTURES(SERIALIZER_UNTYPED_TRAIT)
+#undef SERIALIZER_DECLARE
+#undef SERIALIZER_TYPED_TRAIT
+#undef SERIALIZER_UNTYPED_TRAIT
+
+    template <typename T>
+    constexpr bool IsUntypedStructure = UntypedStructureId<T>::value != SerializedUntypedStructure::Count;
+
+    inline void serializeStructure(StructWriter& writer, const void* structure, uint32_t depth);
+
+    constexpr bool isNamed(const char* name, const char* expected) {
+        while (*name && *name == *expected) {
+            name++;
+            expected++;
+        }
+        return *name == *expected;
+    }
+
+    // The reflection headers do not tell XrTime apart from other 64-bit integers, but the members that hold one are
+    // named time or end with Time.
+    constexpr bool isTimeName(const char* name) {
+        size_t length = 0;
+        while (name[length]) {
+            length++;
+        }
+        return isNamed(name, "time") || (length >= 4 && isNamed(name + length - 4, "Time"));
+    }
+
+    inline void serializeString(StructWriter& writer, const char* string, size_t maxLength) {
+        const size_t length = strnlen(string, std::min(maxLength, MaxStringLength));
+        writer.writeTag(SerializedTag::String);
+        writer.writeVarint(length);
+        writer.writeBytes(string, length);
+    }
+
+    // Values of the basic types, arrays, and structures that we do not know about.
+    template <typename T>
+    void serialize(StructWriter& writer, const T& value, uint32_t depth) {
+        if constexpr (std::is_same_v<T, XrStructureType>) {
+            writer.writeTag(SerializedTag::StructureType);
+            writer.writeVarint(static_cast<uint32_t>(value));
+        } else if constexpr (std::is_same_v<T, XrResult>) {
+            writer.writeTag(SerializedTag::Result);
+            writer.writeSigned(value);
+        } else if constexpr (std::is_enum_v<T>) {
+            writer.writeTag(SerializedTag::Signed);
+            writer.writeSigned(static_cast<int64_t>(value));
+        } else if constexpr (std::is_same_v<T, float>) {
+            writer.writeTag(SerializedTag::Float);
+            writer.writeBytes(&value, sizeof(value));
+        } else if constexpr (std::is_same_v<T, double>) {
+            writer.writeTag(SerializedTag::Double);
+            writer.writeBytes(&value, sizeof(value));
+        } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+            writer.writeTag(SerializedTag::Signed);
+            writer.writeSigned(value);
+        } else if constexpr (std::is_integral_v<T>) {
+            writer.writeTag(SerializedTag::Unsigned);
+            writer.writeVarint(value);
+        } else if constexpr (std::is_array_v<T> && std::is_same_v<std::remove_extent_t<T>, char>) {
+            serializeString(writer, value, std::extent_v<T>);
+        } else if constexpr (std::is_array_v<T>) {
+            writer.writeTag(SerializedTag::Array);
+            writer.writeVarint(std::extent_v<T>);
+            for (size_t i = 0; i < std::min(std::extent_v<T>, MaxArrayElements); i++) {
+                serialize(writer, value[i], depth);
+            }
+        } else if constexpr (std::is_same_v<T, const char*>) {
+            if (value) {
+                serializeString(writer, value, MaxStringLength);
+            } else {
+                writer.writeTag(SerializedTag::Null);
+            }
+        } else if constexpr (std::is_pointer_v<T>) {
+            // We do not know the size of the arrays behind pointers.
+            if (value) {
+                writer.writeTag(SerializedTag::Address);
+                writer.writeVarint(reinterpret_cast<uintptr_t>(value));
+            } else {
+                writer.writeTag(SerializedTag::Null);
+            }
+        } else {
+            writer.writeTag(SerializedTag::Opaque);
+        }
+    }
+
+    // The next member is the only pointer that we follow inside structures. The type is implied by the structure.
+    template <bool IsType, bool IsNext, bool IsTime, typename T>
+    void serializeMember(StructWriter& writer, const T& value, uint32_t depth) {
+        if constexpr (IsType) {
+            return;
+        } else if constexpr (IsNext && std::is_convertible_v<T, const void*>) {
+            serializeStructure(writer, value, depth + 1);
+        } else if constexpr (IsTime && std::is_same_v<T, XrTime>) {
+            writer.writeTag(SerializedTag::Time);
+            writer.writeTime(value);
+        } else {
+            serialize(writer, value, depth);
+        }
+    }
+
+#define SERIALIZER_MEMBER(member)                                                                                      \
+    serializeMember<isNamed(#member, "type"), isNamed(#member, "next"), isTimeName(#member)>(                          \
+        writer, value.member, depth);
+#define SERIALIZER_DEFINE_TYPED(name, ...)                                                                             \
+    inline void serialize(StructWriter& writer, const name& value, uint32_t depth) {                                   \
+        writer.writeTag(SerializedTag::Structure);                                                                     \
+        writer.writeVarint(static_cast<uint32_t>(value.type));                                                         \
+        XR_LIST_STRUCT_##name(SERIALIZER_MEMBER)                                                                       \
+    }
+#define SERIALIZER_DEFINE_UNTYPED(name)                                                                                \
+    inline void serialize(StructWriter& writer, const name& value, uint32_t depth) {                                   \
+        writer.writeTag(SerializedTag::UntypedStructure);                                                              \
+        writer.writeVarint(static_cast<uint32_t>(SerializedUntypedStructure::name));                                   \
+        XR_LIST_STRUCT_##name(SERIALIZER_MEMBER)                                                                       \
+    }
+    XR_LIST_STRUCTURE_TYPES(SERIALIZER_DEFINE_TYPED)
+    SERIALIZER_UNTYPED_STRUCTURES(SERIALIZER_DEFINE_UNTYPED)
+#undef SERIALIZER_DEFINE_TYPED
+#undef SERIALIZER_DEFINE_UNTYPED
+#undef SERIALIZER_MEMBER
+
+    // A structure with a type, followed by the rest of its chain.
+    inline void serializeStructure(StructWriter& writer, const void* structure, uint32_t depth) {
+        if (!structure) {
+            writer.writeTag(SerializedTag::Null);
+            return;
+        }
+        if (depth >= MaxDepth) {
+            writer.writeTag(SerializedTag::Opaque);
+            return;
+        }
+
+        const XrBaseInStructure* const base = reinterpret_cast<const XrBaseInStructure*>(structure);
+        switch (base->type) {
+#define SERIALIZER_CASE(name, type)                                                                                    \
+    case type:                                                                                                         \
+        serialize(writer, *reinterpret_cast<const name*>(structure), depth);                                           \
+        return;
+            XR_LIST_STRUCTURE_TYPES(SERIALIZER_CASE)
+#undef SERIALIZER_CASE
+        default:
+            break;
+        }
+        writer.writeTag(SerializedTag::UnknownStructure);
+        writer.writeVarint(static_cast<uint32_t>(base->type));
+        serializeStructure(writer, base->next, depth + 1);
+    }
+
+    // An argument of a function. Pointers are followed to their first element, so for the arrays of the two-call
+    // idiom, only the first element is written. Before the call, the output arguments (pointers to non-const) are not
+    // initialized yet, so only the input arguments are followed. The arguments are tagged by their C++ type, which
+    // does not tell XrTime apart from the other 64-bit integers, so they are written as plain integers.
+    template <bool IsBeforeCall, typename T>
+    void serializeArgument(StructWriter& writer, const T& value) {
+        if constexpr (std::is_pointer_v<T>) {
+            using Pointee = std::remove_cv_t<std::remove_pointer_t<T>>;
+            constexpr bool IsInput = std::is_const_v<std::remove_pointer_t<T>>;
+            if (!value) {
+                writer.writeTag(SerializedTag::Null);
+            } else if constexpr (IsBeforeCall && !IsInput) {
+                serialize(writer, value, 0);
+            } else if constexpr (IsTypedStructure<Pointee>::value) {
+                writer.writeTag(SerializedTag::Reference);
+                serializeStructure(writer, value, 0);
+            } else if constexpr (IsUntypedStructure<Pointee> ||
+                                 (std::is_arithmetic_v<Pointee> && !std::is_same_v<Pointee, char>) ||
+                                 std::is_enum_v<Pointee>) {
+                writer.writeTag(SerializedTag::Reference);
+                serialize(writer, *value, 0);
+            } else {
+                serialize(writer, value, 0);
+            }
+        } else {
+            serialize(writer, value, 0);
+        }
+    }
+
+} // namespace serializer
+
+// The arguments of a call that returned, including what the runtime wrote in the output arguments.
+template <typename... Args>
+void serializeArguments(StructWriter& writer, const Args&... args) {
+    (serializer::serializeArgument<false>(writer, args), ...);
+}
+
+// The arguments of a call that was not made yet, leaving out the content of the output arguments.
+template <typename... Args>
+void serializeInputArguments(StructWriter& writer, const Args&... args) {
+    (serializer::serializeArgument<true>(writer, args), ...);
+}
@@ -0,0 +1,232 @@
+// MIT License
+//
+// Copyright(c) 2023 Matthieu Bucchianeri
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this softwareand associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+// The size of a structure from its type, from the reflection headers. Returns 0 for types that we do not know about.
+inline size_t getStructureSize(XrStructureType type) {
+    switch (type) {
+#define STRUCTURE_SIZE(name, type)                                                                                     \
+    case type:                                                                                                         \
+        return sizeof(name);
+        XR_LIST_STRUCTURE_TYPES(STRUCTURE_SIZE)
+#undef STRUCTURE_SIZE
+    default:
+        break;
+    }
+    return 0;
+}
+
+// A copy of an output structure chain, as returned by the runtime. Only the contents of the structures are copied
+// back: the application's next pointers are left untouched. The structures must not contain pointers to buffers
+// owned by the application (no two-call idiom), which is the case for the properties structures.
+class StructureChainCache {
+  public:
+    // Fill the application's chain from the cache. Returns false (without writing anything) if any of the structures
+    // in the chain was never returned by the runtime.
+    bool read(XrBaseOutStructure* chain) const {
+        for (const XrBaseOutStructure* entry = chain; entry; entry = entry->next) {
+            if (!find(entry->type)) {
+                return false;
+            }
+        }
+        for (XrBaseOutStructure* entry = chain; entry; entry = entry->next) {
+            const std::vector<uint8_t>& copy = *find(entry->type);
+            memcpy(reinterpret_cast<uint8_t*>(entry) + sizeof(XrBaseOutStructure),
+                   copy.data() + sizeof(XrBaseOutStructure),
+                   copy.size() - sizeof(XrBaseOutStructure));
+        }
+        return true;
+    }
+
+    // Remember the structures returned by the runtime. Types of unknown size are skipped, so that chains containing
+    // them always go to the runtime.
+    void write(const XrBaseOutStructure* chain) {
+        for (const XrBaseOutStructure* entry = chain; entry; entry = entry->next) {
+            const size_t size = getStructureSize(entry->type);
+            if (size < sizeof(XrBaseOutStructure)) {
+                continue;
+            }
+            const uint8_t* const bytes = reinterpret_cast<const uint8_t*>(entry);
+            std::vector<uint8_t> copy(bytes, bytes + size);
+            reinterpret_cast<XrBaseOutStructure*>(copy.data())->next = nullptr;
+            bool replaced = false;
+            for (std::vector<uint8_t>& existing : m_structures) {
+                if (reinterpret_cast<const XrBaseOutStructure*>(existing.data())->type == entry->type) {
+                    existing = std::move(copy);
+                    replaced = true;
+                    break;
+                }
+            }
+            if (!replaced) {
+                m_structures.push_back(std::move(copy));
+            }
+        }
+    }
+
+  private:
+    const std::vector<uint8_t>* find(XrStructureType type) const {
+        for (const std::vector<uint8_t>& copy : m_structures) {
+            if (reinterpret_cast<const XrBaseOutStructure*>(copy.data())->type == type) {
+                return &copy;
+            }
+        }
+        return nullptr;
+    }
+
+    // There are only a few structures per chain, so a linear search is fine.
+    std::vector<std::vector<uint8_t>> m_structures;
+};
+
+// Copy an input structure chain into an arena, so that its structures can be edited before passing them down. The
+// copy stops at the first structure of unknown size, which is shared with the application's chain.
+inline const void* copyStructureChain(Arena& arena, const void* chain) {
+    const void* head = chain;
+    XrBaseInStructure* previous = nullptr;
+    for (const XrBaseInStructure* entry = reinterpret_cast<const XrBaseInStructure*>(chain); entry;
+         entry = entry->next) {
+        const size_t size = getStructureSize(entry->type);
+        if (size < sizeof(XrBaseInStructure)) {
+            break;
+        }
+        XrBaseInStructure* const copy = static_cast<XrBaseInStructure*>(arena.allocate(size));
+        memcpy(copy, entry, size);
+        if (previous) {
+            previous->next = copy;
+        } else {
+            head = copy;
+        }
+        previous = copy;
+    }
+    return head;
+}
+
+// Copy a whole input structure chain into an arena, so that any of its structures can be edited. Returns false when
+// the chain contains a structure of unknown size, in which case nothing of the chain may be edited.
+inline bool copyWholeStructureChain(Arena& arena, const void* chain, XrBaseOutStructure*& copy) {
+    copy = nullptr;
+    XrBaseOutStructure* previous = nullptr;
+    for (const XrBaseInStructure* entry = reinterpret_cast<const XrBaseInStructure*>(chain); entry;
+         entry = entry->next) {
+        const size_t size = getStructureSize(entry->type);
+        if (size < sizeof(XrBaseInStructure)) {
+            copy = nullptr;
+            return false;
+        }
+        XrBaseOutStructure* const entryCopy = static_cast<XrBaseOutStructure*>(arena.allocate(size));
+        memcpy(entryCopy, entry, size);
+        entryCopy->next = nullptr;
+        if (previous) {
+            previous->next = entryCopy;
+        } else {
+            copy = entryCopy;
+        }
+        previous = entryCopy;
+    }
+    return true;
+}
+
+// Find a structure in a chain that we copied with copyWholeStructureChain().
+template <typename T>
+T* findInStructureChain(XrBaseOutStructure* chain, XrStructureType type) {
+    for (XrBaseOutStructure* entry = chain; entry; entry = entry->next) {
+        if (entry->type == type) {
+            return reinterpret_cast<T*>(entry);
+        }
+    }
+    return nullptr;
+}
+
+// Whether we can copy a structure chain of a frame submission with copyStructureChain(): the structures must be ones
+// that we know do not point to other memory of the application.
+inline bool isCopyableFrameChain(const void* chain) {
+    for (const XrBaseInStructure* entry = reinterpret_cast<const XrBaseInStructure*>(chain); entry;
+         entry = entry->next) {
+        switch (entry->type) {
+        case XR_TYPE_COMPOSITION_LAYER_DEPTH_INFO_KHR:
+        case XR_TYPE_COMPOSITION_LAYER_COLOR_SCALE_BIAS_KHR:
+            break;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+// Deep copy of a frame submission into an arena, so that it remains valid after xrEndFrame() returns to the
+// application. Returns nullptr if the submission contains a layer or a structure that we do not know how to copy.
+inline const XrFrameEndInfo* copyFrameEndInfo(Arena& arena, const XrFrameEndInfo& frameEndInfo) {
+    if (!isCopyableFrameChain(frameEndInfo.next)) {
+        return nullptr;
+    }
+    XrFrameEndInfo* const copy = arena.copy(frameEndInfo);
+    copy->next = copyStructureChain(arena, frameEndInfo.next);
+
+    const XrCompositionLayerBaseHeader** const layers =
+        arena.copyArray<const XrCompositionLayerBaseHeader*>(frameEndInfo.layers, frameEndInfo.layerCount);
+    for (uint32_t i = 0; i < frameEndInfo.layerCount; i++) {
+        if (!layers[i] || !isCopyableFrameChain(layers[i]->next)) {
+            return nullptr;
+        }
+
+        switch (layers[i]->type) {
+        case XR_TYPE_COMPOSITION_LAYER_PROJECTION: {
+            XrCompositionLayerProjection* const projection =
+                arena.copy(*reinterpret_cast<const XrCompositionLayerProjection*>(layers[i]));
+            XrCompositionLayerProjectionView* const views = arena.copyArray(projection->views, projection->viewCount);
+            for (uint32_t j = 0; j < projection->viewCount; j++) {
+                if (!isCopyableFrameChain(views[j].next)) {
+                    return nullptr;
+                }
+                views[j].next = copyStructureChain(arena, views[j].next);
+            }
+            projection->views = views;
+            projection->next = copyStructureChain(arena, projection->next);
+            layers[i] = reinterpret_cast<const XrCompositionLayerBaseHeader*>(projection);
+            break;
+        }
+
+        // These layers only hold values (besides their chain).
+        case XR_TYPE_COMPOSITION_LAYER_QUAD:
+        case XR_TYPE_COMPOSITION_LAYER_CYLINDER_KHR:
+        case XR_TYPE_COMPOSITION_LAYER_CUBE_KHR:
+        case XR_TYPE_COMPOSITION_LAYER_EQUIRECT_KHR:
+        case XR_TYPE_COMPOSITION_LAYER_EQUIRECT2_KHR: {
+            const size_t size = getStructureSize(layers[i]->type);
+            if (!size) {
+                return nullptr;
+            }
+            XrCompositionLayerBaseHeader* const layer =
+                static_cast<XrCompositionLayerBaseHeader*>(arena.allocate(size));
+            memcpy(layer, layers[i], size);
+            layer->next = copyStructureChain(arena, layer->next);
+            layers[i] = layer;
+            break;
+        }
+
+        default:
+            return nullptr;
+        }
+    }
+    copy->layers = layers;
+    return copy;
+}
@@ -0,0 +1,118 @@
+// MIT License
+//
+// Copyright(c) 2023 Matthieu Bucchianeri
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this softwareand associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Multiply a value by a 32.32 fixed-point factor. The intermediate product is 128 bits wide, so the value may span
+// hours of performance counter ticks without overflowing.
+inline int64_t mulFixed32(int64_t value, uint64_t factor) {
+#if defined(_M_X64)
+    int64_t high;
+    const int64_t low = _mul128(value, (int64_t)factor, &high);
+    return (int64_t)__shiftright128((uint64_t)low, (uint64_t)high, 32);
+#elif defined(_M_ARM64)
+    const int64_t high = __mulh(value, (int64_t)factor);
+    const uint64_t low = (uint64_t)value * factor;
+    return (int64_t)((low >> 32) | ((uint64_t)high << 32));
+#else
+    return (int64_t)(((__int128)value * (__int128)factor) >> 32);
+#endif
+}
+
+// A linear mapping between two clocks, such as the performance counter and XrTime. The mapping is published with a
+// sequence lock: readers never block and never call into the runtime, and a writer (serialized by the caller) only
+// makes readers retry.
+class ClockMapping {
+  public:
+    struct Parameters {
+        int64_t sourceOrigin;
+        int64_t targetOrigin;
+
+        // Target units per source unit, and the opposite, in 32.32 fixed-point. Zero when not calibrated.
+        uint64_t forwardScale;
+        uint64_t inverseScale;
+    };
+
+    // Compute the parameters from two points measured on both clocks. Both spans must fit in 32 bits.
+    static bool fromSamples(
+        int64_t source0, int64_t target0, int64_t source1, int64_t target1, Parameters& parameters) {
+        const int64_t sourceSpan = source1 - source0;
+        const int64_t targetSpan = target1 - target0;
+        if (sourceSpan <= 0 || targetSpan <= 0 || sourceSpan > UINT32_MAX || targetSpan > UINT32_MAX) {
+            return false;
+        }
+
+        parameters.sourceOrigin = source0;
+        parameters.targetOrigin = target0;
+        parameters.forwardScale = ((uint64_t)targetSpan << 32) / (uint64_t)sourceSpan;
+        parameters.inverseScale = ((uint64_t)sourceSpan << 32) / (uint64_t)targetSpan;
+        return parameters.forwardScale && parameters.inverseScale;
+    }
+
+    static int64_t forward(const Parameters& parameters, int64_t source) {
+        return parameters.targetOrigin + mulFixed32(source - parameters.sourceOrigin, parameters.forwardScale);
+    }
+
+    static int64_t inverse(const Parameters& parameters, int64_t target) {
+        return parameters.sourceOrigin + mulFixed32(target - parameters.targetOrigin, parameters.inverseScale);
+    }
+
+    // Read a consistent copy of the parameters. Returns false if the mapping is not calibrated.
+    bool load(Parameters& parameters) const {
+        uint32_t sequence;
+        do {
+            sequence = m_sequence.load(std::memory_order_acquire);
+            parameters.sourceOrigin = m_sourceOrigin.load(std::memory_order_relaxed);
+            parameters.targetOrigin = m_targetOrigin.load(std::memory_order_relaxed);
+            parameters.forwardScale = m_forwardScale.load(std::memory_order_relaxed);
+            parameters.inverseScale = m_inverseScale.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+        } while ((sequence & 1) || sequence != m_sequence.load(std::memory_order_relaxed));
+        return parameters.forwardScale != 0;
+    }
+
+    void store(const Parameters& parameters) {
+        const uint32_t sequence = m_sequence.load(std::memory_order_relaxed);
+        m_sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_sourceOrigin.store(parameters.sourceOrigin, std::memory_order_relaxed);
+        m_targetOrigin.store(parameters.targetOrigin, std::memory_order_relaxed);
+        m_forwardScale.store(parameters.forwardScale, std::memory_order_relaxed);
+        m_inverseScale.store(parameters.inverseScale, std::memory_order_relaxed);
+        m_sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    void clear() {
+        store(Parameters{});
+    }
+
+  private:
+    std::atomic<uint32_t> m_sequence{0};
+    std::atomic<int64_t> m_sourceOrigin{0};
+    std::atomic<int64_t> m_targetOrigin{0};
+    std::atomic<uint64_t> m_forwardScale{0};
+    std::atomic<uint64_t> m_inverseScale{0};
+};
@@ -0,0 +1,97 @@
+// MIT License
+//
+// Copyright(c) 2023 Matthieu Bucchianeri
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this softwareand associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+// Build a visibility mask for a view, in the same space as XR_KHR_visibility_mask (the z = -1 plane of the view).
+// Without knowledge of the lens, we assume that the visible area is an ellipse centered on the field of view, and we
+// make that ellipse larger than the one inscribed in the field of view so that the mask only covers the corners, which
+// are hidden by the lens on every headset that we know of.
+inline void makeVisibilityMask(const XrFovf& fov,
+                               XrVisibilityMaskTypeKHR visibilityMaskType,
+                               std::vector<XrVector2f>& vertices,
+                               std::vector<uint32_t>& indices) {
+    // Radius of the ellipse, relative to the half-extents of the field of view. The ellipse goes through the corners
+    // at sqrt(2).
+    constexpr float EllipseScale = 1.2f;
+
+    // Number of segments around the ellipse. A multiple of 8, so that the corners are exact samples.
+    constexpr uint32_t Segments = 64;
+
+    const float left = std::tan(fov.angleLeft);
+    const float right = std::tan(fov.angleRight);
+    const float down = std::tan(fov.angleDown);
+    const float up = std::tan(fov.angleUp);
+    const XrVector2f center{(left + right) / 2, (down + up) / 2};
+    const XrVector2f halfExtent{(right - left) / 2, (up - down) / 2};
+
+    // Walk counter-clockwise around the edge of the visible area (the ellipse, cut by the field of view), and around
+    // the field of view itself, along the same rays from the center.
+    std::vector<XrVector2f> inner(Segments);
+    std::vector<XrVector2f> outer(Segments);
+    for (uint32_t i = 0; i < Segments; i++) {
+        const float angle = 2 * 3.14159265358979f * i / Segments;
+        const float cosAngle = std::cos(angle);
+        const float sinAngle = std::sin(angle);
+        const float edge = 1 / std::max(std::abs(cosAngle), std::abs(sinAngle));
+        const float radius = std::min(EllipseScale, edge);
+        inner[i] = {center.x + radius * halfExtent.x * cosAngle, center.y + radius * halfExtent.y * sinAngle};
+        outer[i] = {center.x + edge * halfExtent.x * cosAngle, center.y + edge * halfExtent.y * sinAngle};
+    }
+
+    vertices.clear();
+    indices.clear();
+    switch (visibilityMaskType) {
+    case XR_VISIBILITY_MASK_TYPE_HIDDEN_TRIANGLE_MESH_KHR:
+        // Two triangles between each pair of rays. Where the ellipse is cut by the field of view, they are degenerate.
+        for (uint32_t i = 0; i < Segments; i++) {
+            vertices.push_back(inner[i]);
+            vertices.push_back(outer[i]);
+        }
+        for (uint32_t i = 0; i < Segments; i++) {
+            const uint32_t next = (i + 1) % Segments;
+            const uint32_t triangles[] = {2 * i, 2 * i + 1, 2 * next + 1, 2 * i, 2 * next + 1, 2 * next};
+            indices.insert(indices.end(), std::begin(triangles), std::end(triangles));
+        }
+        break;
+
+    case XR_VISIBILITY_MASK_TYPE_VISIBLE_TRIANGLE_MESH_KHR:
+        // A fan around the center.
+        vertices.push_back(center);
+        vertices.insert(vertices.end(), inner.cbegin(), inner.cend());
+        for (uint32_t i = 0; i < Segments; i++) {
+            const uint32_t triangle[] = {0, 1 + i, 1 + (i + 1) % Segments};
+            indices.insert(indices.end(), std::begin(triangle), std::end(triangle));
+        }
+        break;
+
+    case XR_VISIBILITY_MASK_TYPE_LINE_LOOP_KHR:
+        vertices = inner;
+        for (uint32_t i = 0; i < Segments; i++) {
+            indices.push_back(i);
+        }
+        break;
+
+    default:
+        break;
+    }
+}